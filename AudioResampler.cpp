@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico.h"
+#include "FrensHelpers.h"
+#include "settings.h"
+#include "AudioResampler.h"
+
+// Input frames the filter history holds before it is compacted
+#define AUDIO_RESAMPLER_HISTORY (AUDIO_RESAMPLER_MAX_TAPS + 64)
+
+namespace Frens
+{
+    static_assert((AUDIO_RESAMPLER_PHASES & (AUDIO_RESAMPLER_PHASES - 1)) == 0, "AUDIO_RESAMPLER_PHASES must be a power of two");
+    static constexpr int phaseShift = 32 - __builtin_ctz(AUDIO_RESAMPLER_PHASES);
+
+    static int16_t coeffs[AUDIO_RESAMPLER_PHASES][AUDIO_RESAMPLER_MAX_TAPS];
+    static int16_t history[AUDIO_RESAMPLER_HISTORY * 2];
+    static int16_t outBlock[AUDIO_RESAMPLER_BLOCK * 2];
+    static int historyCount;          // frames in history
+    static int historyPos;            // first tap of the next output
+    static int outCount;              // frames in outBlock
+    static uint32_t phase;            // output position past historyPos, Q32
+    static uint32_t stepInt, stepFrac; // input frames per output frame
+    static uint64_t baseStep;          // the same without drift correction, Q32
+    static uint32_t inputRate, outputRate;
+    static ResamplerQuality filterQuality = ResamplerQuality::Sinc8;
+    static bool passThrough = true;
+    static int32_t ratioPpm;
+    static bool servoEnabled;
+    static int servoTarget = AUDIO_SERVO_TARGET_PERMILLE;
+    static int32_t fillFiltered = -1; // permille, Q8, -1 until the first sample
+    static int32_t servoIntegral;
+    static AudioServoStats servoStats = {0, -1, 1000, 0, 0, 0};
+
+#if HSTX
+    static_assert(sizeof(audio_sample_t) == 2 * sizeof(int16_t), "audio_sample_t must be interleaved left/right");
+#endif
+    static void __not_in_flash_func(defaultSink)(const int16_t *lr, int frames)
+    {
+#if HSTX
+        if (!settings.flags.useExtAudio && !isHeadPhoneJackConnected())
+        {
+            hstx_push_audio_block(reinterpret_cast<const audio_sample_t *>(lr), frames);
+            return;
+        }
+#endif
+        for (int i = 0; i < frames; i++, lr += 2)
+        {
+            EXT_AUDIO_ENQUEUE_SAMPLE(lr[0], lr[1]);
+        }
+    }
+    static AudioResamplerSink sink = defaultSink;
+
+    static int (*fillQuery)(void) = getAudioOutputFillPermille;
+
+    // One row of taps per phase, each row normalised to unity gain at DC. The
+    // phases are sampled in the middle of the interval they cover.
+    static void buildTable()
+    {
+        const int taps = (int)filterQuality;
+        // Cut-off at 90% of the lower of the two Nyquist frequencies
+        float cutoff = outputRate < inputRate ? 0.9f * outputRate / inputRate : 0.9f;
+        for (int p = 0; p < AUDIO_RESAMPLER_PHASES; p++)
+        {
+            float frac = (p + 0.5f) / AUDIO_RESAMPLER_PHASES;
+            float row[AUDIO_RESAMPLER_MAX_TAPS];
+            float sum = 0;
+            for (int k = 0; k < taps; k++)
+            {
+                // Distance from the output position in input samples
+                float t = k - (taps / 2 - 1) - frac;
+                float h;
+                if (filterQuality == ResamplerQuality::Linear)
+                {
+                    h = 1.0f - fabsf(t);
+                }
+                else
+                {
+                    float x = (float)M_PI * cutoff * t;
+                    float w = 2.0f * (float)M_PI * t / taps;
+                    h = (x == 0.0f ? 1.0f : sinf(x) / x) * (0.42f + 0.5f * cosf(w) + 0.08f * cosf(2.0f * w)); // Blackman
+                }
+                row[k] = h;
+                sum += h;
+            }
+            // Rounding error goes to the largest tap
+            int total = 0, largest = 0;
+            for (int k = 0; k < taps; k++)
+            {
+                coeffs[p][k] = (int16_t)lrintf(row[k] * 32768.0f / sum);
+                total += coeffs[p][k];
+                if (coeffs[p][k] > coeffs[p][largest])
+                {
+                    largest = k;
+                }
+            }
+            coeffs[p][largest] += 32768 - total;
+        }
+    }
+
+    // Starts with half a filter of silence, so the first output lines up with the first input.
+    static void resetHistory()
+    {
+        historyCount = (int)filterQuality / 2 - 1;
+        memset(history, 0, historyCount * 2 * sizeof(int16_t));
+        historyPos = 0;
+        phase = 0;
+    }
+
+    static inline int16_t saturate(int32_t v)
+    {
+        return v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+    }
+
+    // Applies ratioPpm to the nominal step. Switching from pass-through to
+    // filtering starts from a clean history.
+    static void __not_in_flash_func(updateStep)()
+    {
+        uint64_t step = baseStep + (int64_t)baseStep * ratioPpm / 1000000;
+        stepInt = (uint32_t)(step >> 32);
+        stepFrac = (uint32_t)step;
+        bool through = step == (1ull << 32) && !servoEnabled;
+        if (passThrough && !through)
+        {
+            resetHistory();
+        }
+        passThrough = through;
+    }
+
+    static void __not_in_flash_func(servoUpdate)()
+    {
+        int fill = fillQuery ? fillQuery() : -1;
+        if (fill < 0)
+        {
+            return;
+        }
+        servoStats.updates++;
+        if (fill < servoStats.minFillPermille)
+        {
+            servoStats.minFillPermille = fill;
+        }
+        if (fill > servoStats.maxFillPermille)
+        {
+            servoStats.maxFillPermille = fill;
+        }
+        if (fillFiltered < 0)
+        {
+            fillFiltered = fill << 8;
+        }
+        fillFiltered += ((fill << 8) - fillFiltered) >> AUDIO_SERVO_FILTER_SHIFT;
+        int32_t error = (fillFiltered >> 8) - servoTarget;
+        // The integral is clamped as well, so it cannot wind up while saturated
+        const int32_t integralLimit = AUDIO_SERVO_MAX_PPM << AUDIO_SERVO_KI_SHIFT;
+        servoIntegral += error;
+        servoIntegral = servoIntegral > integralLimit ? integralLimit : servoIntegral < -integralLimit ? -integralLimit : servoIntegral;
+        int32_t ppm = AUDIO_SERVO_KP * error + (servoIntegral >> AUDIO_SERVO_KI_SHIFT);
+        if (ppm >= AUDIO_SERVO_MAX_PPM || ppm <= -AUDIO_SERVO_MAX_PPM)
+        {
+            ppm = ppm > 0 ? AUDIO_SERVO_MAX_PPM : -AUDIO_SERVO_MAX_PPM;
+            servoStats.saturated++;
+        }
+        servoStats.fillPermille = fillFiltered >> 8;
+        servoStats.ppm = ppm;
+        if (ppm != ratioPpm)
+        {
+            ratioPpm = ppm;
+            updateStep();
+        }
+    }
+
+    static inline void __not_in_flash_func(emit)(int16_t left, int16_t right)
+    {
+        outBlock[outCount * 2] = left;
+        outBlock[outCount * 2 + 1] = right;
+        if (++outCount == AUDIO_RESAMPLER_BLOCK)
+        {
+            sink(outBlock, AUDIO_RESAMPLER_BLOCK);
+            outCount = 0;
+            if (servoEnabled)
+            {
+                servoUpdate();
+            }
+        }
+    }
+
+    // Produces every output the history covers. The tap count is a template
+    // argument so the inner loop unrolls for each quality.
+    template <int TAPS>
+    static void __not_in_flash_func(convert)()
+    {
+        while (historyPos + TAPS <= historyCount)
+        {
+            const int16_t *c = coeffs[phase >> phaseShift];
+            const int16_t *x = history + historyPos * 2;
+            int32_t left = 1 << 14, right = 1 << 14;
+            for (int k = 0; k < TAPS; k++)
+            {
+                left += c[k] * x[k * 2];
+                right += c[k] * x[k * 2 + 1];
+            }
+            emit(saturate(left >> 15), saturate(right >> 15));
+            uint32_t next = phase + stepFrac;
+            historyPos += stepInt + (next < phase);
+            phase = next;
+        }
+    }
+
+    // Moves the taps still needed to the start of the history.
+    static void __not_in_flash_func(compact)()
+    {
+        if (historyPos >= historyCount)
+        {
+            historyPos -= historyCount;
+            historyCount = 0;
+            return;
+        }
+        historyCount -= historyPos;
+        memmove(history, history + historyPos * 2, historyCount * 2 * sizeof(int16_t));
+        historyPos = 0;
+    }
+
+    void audioResamplerInit(uint32_t inRate, uint32_t outRate, ResamplerQuality quality)
+    {
+        inputRate = inRate;
+        outputRate = outRate;
+        baseStep = ((uint64_t)inRate << 32) / outRate;
+        outCount = 0;
+        setAudioResamplerQuality(quality);
+        passThrough = false;
+        updateStep();
+    }
+
+    void setAudioResamplerQuality(ResamplerQuality quality)
+    {
+        filterQuality = quality;
+        buildTable();
+        resetHistory();
+    }
+
+    ResamplerQuality getAudioResamplerQuality()
+    {
+        return filterQuality;
+    }
+
+    void setAudioResamplerSink(AudioResamplerSink newSink)
+    {
+        sink = newSink ? newSink : defaultSink;
+    }
+
+    void __not_in_flash_func(audioResamplerPush)(const int16_t *lr, int frames)
+    {
+        if (passThrough)
+        {
+            for (int i = 0; i < frames; i++, lr += 2)
+            {
+                emit(lr[0], lr[1]);
+            }
+            return;
+        }
+        while (frames > 0)
+        {
+            if (historyCount == AUDIO_RESAMPLER_HISTORY)
+            {
+                compact();
+            }
+            int n = AUDIO_RESAMPLER_HISTORY - historyCount;
+            if (n > frames)
+            {
+                n = frames;
+            }
+            memcpy(history + historyCount * 2, lr, n * 2 * sizeof(int16_t));
+            historyCount += n;
+            lr += n * 2;
+            frames -= n;
+            switch (filterQuality)
+            {
+            case ResamplerQuality::Linear:
+                convert<(int)ResamplerQuality::Linear>();
+                break;
+            case ResamplerQuality::Sinc8:
+                convert<(int)ResamplerQuality::Sinc8>();
+                break;
+            case ResamplerQuality::Sinc16:
+                convert<(int)ResamplerQuality::Sinc16>();
+                break;
+            }
+        }
+    }
+
+    void setAudioResamplerRatioPpm(int32_t ppm)
+    {
+        if (!servoEnabled)
+        {
+            ratioPpm = ppm;
+            updateStep();
+        }
+    }
+
+    int32_t getAudioResamplerRatioPpm()
+    {
+        return ratioPpm;
+    }
+
+    void setAudioDriftServo(bool enabled, int targetPermille)
+    {
+        servoTarget = targetPermille;
+        if (enabled != servoEnabled)
+        {
+            // Each run starts from the nominal ratio and a fresh fill estimate
+            servoEnabled = enabled;
+            servoIntegral = 0;
+            fillFiltered = -1;
+            ratioPpm = 0;
+            updateStep();
+        }
+    }
+
+    bool isAudioDriftServoEnabled()
+    {
+        return servoEnabled;
+    }
+
+    void setAudioDriftFillQuery(int (*query)(void))
+    {
+        fillQuery = query ? query : getAudioOutputFillPermille;
+    }
+
+    void getAudioServoStats(AudioServoStats &stats)
+    {
+        stats = servoStats;
+    }
+
+    void resetAudioServoStats()
+    {
+        servoStats.minFillPermille = 1000;
+        servoStats.maxFillPermille = 0;
+        servoStats.updates = 0;
+        servoStats.saturated = 0;
+    }
+
+    void __not_in_flash_func(audioResamplerPushSample)(int left, int right)
+    {
+        int16_t lr[2] = {(int16_t)left, (int16_t)right};
+        audioResamplerPush(lr, 1);
+    }
+
+    void audioResamplerFlush()
+    {
+        if (outCount)
+        {
+            sink(outBlock, outCount);
+            outCount = 0;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+
+// Shared fixed-point sample-rate converter in front of all audio outputs.
+//
+// Emulators push stereo samples at their native rate (SNES ~32 kHz, the
+// NTSC-derived NES/Genesis rates) and the resampler converts them to the
+// output rate: DVIAUDIOFREQ or PICO_AUDIO_I2S_FREQ for the external DAC,
+// pico_hdmi_get_audio_sample_rate() for HDMI audio on HSTX. It is a polyphase
+// windowed-sinc FIR with Q15 coefficients: AUDIO_RESAMPLER_PHASES sub-sample
+// phases, the quality setting picks the taps per output sample. The table is
+// computed on init and on a quality change; converting is integer only and
+// runs from SRAM. Output goes to the sink in blocks of AUDIO_RESAMPLER_BLOCK
+// samples. With equal rates samples pass straight through.
+#ifndef AUDIO_RESAMPLER_PHASES
+#define AUDIO_RESAMPLER_PHASES 64 // power of two
+#endif
+#define AUDIO_RESAMPLER_MAX_TAPS 16
+// Output samples handed to the sink at a time
+#define AUDIO_RESAMPLER_BLOCK 32
+
+// Clock-drift servo. The emulator and the audio output run on different
+// clocks, so at a fixed ratio the output buffer slowly fills up (HDMI packets
+// dropped above HSTX_AUDIO_DI_HIGH_WATERMARK) or runs dry (silence). With the
+// servo on, every block handed to the sink samples the output buffer fill, a
+// low-pass filter removes the per-frame sawtooth of bursty producers and a PI
+// controller nudges the resampling ratio by parts per million so the buffer
+// sits at the target fill. The correction is limited to AUDIO_SERVO_MAX_PPM,
+// 0.5% is below audible pitch change.
+#ifndef AUDIO_SERVO_MAX_PPM
+#define AUDIO_SERVO_MAX_PPM 5000
+#endif
+#define AUDIO_SERVO_TARGET_PERMILLE 500
+// Gains per block: proportional in ppm per permille of fill error, the
+// integral term adds the summed error >> AUDIO_SERVO_KI_SHIFT ppm. Checked
+// with tests/host/servo_sim.cpp against a modelled sink clock.
+#ifndef AUDIO_SERVO_KP
+#define AUDIO_SERVO_KP 8
+#endif
+#ifndef AUDIO_SERVO_KI_SHIFT
+#define AUDIO_SERVO_KI_SHIFT 10
+#endif
+// Fill filter weight 1 / (1 << AUDIO_SERVO_FILTER_SHIFT) per block
+#define AUDIO_SERVO_FILTER_SHIFT 8
+
+namespace Frens
+{
+    // Taps per output sample; more taps give a steeper filter at more CPU. The
+    // cut-off (-6 dB) is at 90% of the lower Nyquist frequency. For tones up to
+    // half / 80% of that band (worst case, measured by tests/host/resampler_test):
+    // Linear is plain interpolation, -2.5 dB at half the band with images at
+    // -20 / -10 dB; Sinc8 is within 1 dB to half the band with images and
+    // aliases below -40 / -20 dB; Sinc16 is within 0.2 dB to 60% with images
+    // and aliases below -40 dB throughout. Tones close to the cut-off leave
+    // images of about -8 dB (Linear) to -17 dB (Sinc16).
+    enum class ResamplerQuality : uint8_t
+    {
+        Linear = 2,
+        Sinc8 = 8,
+        Sinc16 = 16,
+    };
+    // Receives interleaved left/right samples at the output rate.
+    typedef void (*AudioResamplerSink)(const int16_t *lr, int frames);
+
+    // Sets the rates and quality and clears the filter history.
+    void audioResamplerInit(uint32_t inRate, uint32_t outRate, ResamplerQuality quality = ResamplerQuality::Sinc8);
+    void setAudioResamplerQuality(ResamplerQuality quality);
+    ResamplerQuality getAudioResamplerQuality();
+    // nullptr restores the default sink: on HSTX the external DAC when
+    // settings.flags.useExtAudio is set or headphones are connected, HDMI audio
+    // otherwise; on DVI the external DAC (the DVI audio ring is fed by the app).
+    void setAudioResamplerSink(AudioResamplerSink sink);
+    // Queues interleaved left/right samples at the input rate.
+    void audioResamplerPush(const int16_t *lr, int frames);
+    void audioResamplerPushSample(int left, int right);
+    // Hands converted samples still waiting for a full block to the sink.
+    void audioResamplerFlush();
+
+    struct AudioServoStats
+    {
+        int32_t ppm;          // current ratio correction, positive consumes input faster
+        int fillPermille;     // filtered output buffer fill
+        int minFillPermille;  // unfiltered extremes since the last reset
+        int maxFillPermille;
+        uint32_t updates;     // blocks the servo has seen
+        uint32_t saturated;   // updates with the correction at AUDIO_SERVO_MAX_PPM
+    };
+    // Fixed correction of the input/output ratio, ignored while the servo runs.
+    void setAudioResamplerRatioPpm(int32_t ppm);
+    int32_t getAudioResamplerRatioPpm();
+    void setAudioDriftServo(bool enabled, int targetPermille = AUDIO_SERVO_TARGET_PERMILLE);
+    bool isAudioDriftServoEnabled();
+    // Output buffer fill in permille (0..1000), -1 when unknown. nullptr
+    // restores the default, which follows the default sink: the buffered
+    // HDMI audio against HSTX_AUDIO_DI_HIGH_WATERMARK, or the I2S ring.
+    void setAudioDriftFillQuery(int (*query)(void));
+    void getAudioServoStats(AudioServoStats &stats);
+    void resetAudioServoStats();
+}
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico.h"
+#include "pico/time.h"
+#include "FrensHelpers.h"
+#include "FrensFonts.h"
+#include "FramePerf.h"
+
+static_assert((FRAMEPERF_RING_SIZE & (FRAMEPERF_RING_SIZE - 1)) == 0, "FRAMEPERF_RING_SIZE must be a power of two");
+
+namespace Frens
+{
+    static FramePerfRecord perfRing[FRAMEPERF_RING_SIZE];
+    static uint32_t perfCount = 0; // frames recorded since the last reset, ring index = count & mask
+    static uint32_t pendingUnderruns = 0;
+    static uint32_t pendingOverruns = 0;
+    // The first frame after boot or resetFramePerf straddles the reset: it only
+    // sets the baselines for the next one and is not recorded.
+    static bool baselinePending = true;
+#if HSTX
+    static uint32_t lastDiUnderruns = 0;
+    static uint32_t lastDiOverruns = 0;
+    static uint32_t lastCore1BusyUs = 0;
+#endif
+    static bool overlayEnabled = false;
+    static char overlayText[FRAMEPERF_OVERLAY_ROWS][FRAMEPERF_OVERLAY_COLS + 1];
+
+    static inline uint8_t saturate8(uint32_t v)
+    {
+        return v > 255 ? 255 : (uint8_t)v;
+    }
+
+    static inline uint16_t saturate16(uint32_t v)
+    {
+        return v > 65535 ? 65535 : (uint16_t)v;
+    }
+
+    // Formats us as milliseconds with one decimal
+    static void formatMs(char *buf, size_t size, uint32_t us)
+    {
+        uint32_t tenths = (us + 50) / 100;
+        snprintf(buf, size, "%lu.%lu", (unsigned long)(tenths / 10), (unsigned long)(tenths % 10));
+    }
+
+    static void updateOverlayText()
+    {
+        FramePerfSummary s;
+        getFramePerfSummary(s, FRAMEPERF_RING_SIZE);
+        char a[8], b[8], c[8];
+        formatMs(a, sizeof(a), s.busyMinUs);
+        formatMs(b, sizeof(b), s.busyAvgUs);
+        formatMs(c, sizeof(c), s.busyP99Us);
+        snprintf(overlayText[0], sizeof(overlayText[0]), "emu  %s/%s/%s ms", a, b, c);
+        formatMs(a, sizeof(a), s.waitMinUs);
+        formatMs(b, sizeof(b), s.waitAvgUs);
+        formatMs(c, sizeof(c), s.waitP99Us);
+        snprintf(overlayText[1], sizeof(overlayText[1]), "wait %s/%s/%s ms", a, b, c);
+        snprintf(overlayText[2], sizeof(overlayText[2]), "miss %lu aud u%lu o%lu", (unsigned long)s.vsyncMisses,
+                 (unsigned long)s.audioUnderruns, (unsigned long)s.audioOverruns);
+        if (s.core1BusyPermille >= 0)
+        {
+            snprintf(overlayText[3], sizeof(overlayText[3]), "core0 %d%% core1 %d%%", s.core0BusyPermille / 10,
+                     s.core1BusyPermille / 10);
+        }
+        else
+        {
+            snprintf(overlayText[3], sizeof(overlayText[3]), "core0 %d%%", s.core0BusyPermille / 10);
+        }
+#if HSTX
+        video_output_line_stats_t ls;
+        video_output_get_line_stats(&ls);
+        if (ls.line_period_cycles)
+        {
+            snprintf(overlayText[4], sizeof(overlayText[4]), "line %lu%% late %lu p%lu f%lu o%lu",
+                     (unsigned long)((uint64_t)ls.max_cycles * 100 / ls.line_period_cycles), (unsigned long)ls.late,
+                     (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_PSRAM],
+                     (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_FLASH],
+                     (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_OTHER]);
+        }
+#endif
+    }
+
+    void framePerfEndFrame(uint32_t busyUs, uint32_t waitUs, uint32_t vsyncMisses)
+    {
+        if (baselinePending)
+        {
+            baselinePending = false;
+            pendingUnderruns = 0;
+            pendingOverruns = 0;
+#if HSTX
+            lastDiUnderruns = hstx_di_queue_get_underrun_count();
+            lastDiOverruns = hstx_di_queue_get_overrun_count();
+            lastCore1BusyUs = video_output_get_core1_busy_us();
+#endif
+            return;
+        }
+        FramePerfRecord &r = perfRing[perfCount & (FRAMEPERF_RING_SIZE - 1)];
+        r.busyUs = saturate16(busyUs);
+        r.waitUs = saturate16(waitUs);
+        r.vsyncMisses = saturate8(vsyncMisses);
+        uint32_t underruns = pendingUnderruns;
+        uint32_t overruns = pendingOverruns;
+        pendingUnderruns = 0;
+        pendingOverruns = 0;
+        r.core1Busy = 255;
+#if HSTX
+        uint32_t diUnderruns = hstx_di_queue_get_underrun_count();
+        uint32_t diOverruns = hstx_di_queue_get_overrun_count();
+        uint32_t core1BusyUs = video_output_get_core1_busy_us();
+        underruns += diUnderruns - lastDiUnderruns;
+        overruns += diOverruns - lastDiOverruns;
+        uint32_t frameUs = busyUs + waitUs;
+        if (frameUs)
+        {
+            r.core1Busy = saturate8((core1BusyUs - lastCore1BusyUs) * 100 / frameUs);
+        }
+        lastDiUnderruns = diUnderruns;
+        lastDiOverruns = diOverruns;
+        lastCore1BusyUs = core1BusyUs;
+#endif
+        r.audioUnderruns = saturate8(underruns);
+        r.audioOverruns = saturate8(overruns);
+        perfCount++;
+        if (overlayEnabled && perfCount % FRAMEPERF_OVERLAY_INTERVAL == 0)
+        {
+            updateOverlayText();
+        }
+    }
+
+    void framePerfAudioUnderrun(uint32_t count)
+    {
+        pendingUnderruns += count;
+    }
+
+    void framePerfAudioOverrun(uint32_t count)
+    {
+        pendingOverruns += count;
+    }
+
+    // Keeps the k largest values seen in top[0..k-1], descending.
+    static inline void keepLargest(uint32_t *top, int k, uint32_t v)
+    {
+        if (v <= top[k - 1])
+        {
+            return;
+        }
+        int i = k - 1;
+        while (i > 0 && top[i - 1] < v)
+        {
+            top[i] = top[i - 1];
+            i--;
+        }
+        top[i] = v;
+    }
+
+    void getFramePerfSummary(FramePerfSummary &summary, int frames)
+    {
+        memset(&summary, 0, sizeof(summary));
+        summary.core1BusyPermille = -1;
+        uint32_t n = perfCount < FRAMEPERF_RING_SIZE ? perfCount : FRAMEPERF_RING_SIZE;
+        if (frames > 0 && (uint32_t)frames < n)
+        {
+            n = frames;
+        }
+        if (n == 0)
+        {
+            return;
+        }
+        // p99 is the k-th largest sample, k = n - ceil(0.99 * n) + 1
+        constexpr int MAXK = FRAMEPERF_RING_SIZE / 100 + 2;
+        int k = (int)(n - (n * 99 + 99) / 100 + 1);
+        uint32_t busyTop[MAXK] = {0}, waitTop[MAXK] = {0};
+        uint64_t busySum = 0, waitSum = 0, core1Sum = 0;
+        uint32_t core1Frames = 0;
+        summary.busyMinUs = UINT32_MAX;
+        summary.waitMinUs = UINT32_MAX;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const FramePerfRecord &r = perfRing[(perfCount - 1 - i) & (FRAMEPERF_RING_SIZE - 1)];
+            busySum += r.busyUs;
+            waitSum += r.waitUs;
+            summary.busyMinUs = std::min<uint32_t>(summary.busyMinUs, r.busyUs);
+            summary.busyMaxUs = std::max<uint32_t>(summary.busyMaxUs, r.busyUs);
+            summary.waitMinUs = std::min<uint32_t>(summary.waitMinUs, r.waitUs);
+            keepLargest(busyTop, k, r.busyUs);
+            keepLargest(waitTop, k, r.waitUs);
+            summary.vsyncMisses += r.vsyncMisses;
+            summary.audioUnderruns += r.audioUnderruns;
+            summary.audioOverruns += r.audioOverruns;
+            if (r.core1Busy != 255)
+            {
+                core1Sum += (uint64_t)r.core1Busy * (r.busyUs + r.waitUs);
+                core1Frames++;
+            }
+        }
+        summary.frames = n;
+        summary.busyAvgUs = (uint32_t)(busySum / n);
+        summary.waitAvgUs = (uint32_t)(waitSum / n);
+        summary.busyP99Us = busyTop[k - 1];
+        summary.waitP99Us = waitTop[k - 1];
+        uint64_t totalUs = busySum + waitSum;
+        summary.core0BusyPermille = totalUs ? (int)(busySum * 1000 / totalUs) : 0;
+        if (core1Frames && totalUs)
+        {
+            // core1Busy is in percent, weighted by frame length
+            summary.core1BusyPermille = (int)(core1Sum * 10 / totalUs);
+        }
+    }
+
+    bool getFramePerfRecord(int age, FramePerfRecord &record)
+    {
+        uint32_t n = perfCount < FRAMEPERF_RING_SIZE ? perfCount : FRAMEPERF_RING_SIZE;
+        if (age < 0 || (uint32_t)age >= n)
+        {
+            return false;
+        }
+        record = perfRing[(perfCount - 1 - age) & (FRAMEPERF_RING_SIZE - 1)];
+        return true;
+    }
+
+    void resetFramePerf()
+    {
+        perfCount = 0;
+        baselinePending = true;
+        pendingUnderruns = 0;
+        pendingOverruns = 0;
+        memset(overlayText, 0, sizeof(overlayText));
+#if HSTX
+        video_output_reset_line_stats();
+#endif
+    }
+
+    void setFramePerfOverlay(bool enabled)
+    {
+        overlayEnabled = enabled;
+        if (enabled)
+        {
+            updateOverlayText();
+        }
+    }
+
+    bool isFramePerfOverlayEnabled()
+    {
+        return overlayEnabled;
+    }
+
+    void drawFramePerfOverlayLine(int line, uint16_t *dst, int width)
+    {
+        if (!overlayEnabled || line < 0 || line >= FRAMEPERF_OVERLAY_ROWS * FONT_CHAR_HEIGHT)
+        {
+            return;
+        }
+        const char *text = overlayText[line / FONT_CHAR_HEIGHT];
+        int rowInChar = line % FONT_CHAR_HEIGHT;
+        int cols = std::min<int>(FRAMEPERF_OVERLAY_COLS, width / FONT_CHAR_WIDTH);
+        // Pad with spaces so the background box has a fixed width
+        bool end = false;
+        for (int col = 0; col < cols; col++)
+        {
+            end = end || text[col] == 0;
+            char fontSlice = getcharslicefrom8x8font(end ? ' ' : text[col], rowInChar);
+            for (int bit = 0; bit < FONT_CHAR_WIDTH; bit++)
+            {
+                *dst++ = (fontSlice & 1) ? 0xFFFF : 0x0000;
+                fontSlice >>= 1;
+            }
+        }
+    }
+
+    void drawFramePerfOverlay(uint16_t *framebuffer, int width, int height, int stride)
+    {
+        int lines = std::min<int>(height, FRAMEPERF_OVERLAY_ROWS * FONT_CHAR_HEIGHT);
+        for (int line = 0; line < lines; line++)
+        {
+            drawFramePerfOverlayLine(line, framebuffer + line * stride, width);
+        }
+    }
+
+    void dumpFramePerf(const char *path)
+    {
+        FramePerfSummary s;
+        getFramePerfSummary(s, FRAMEPERF_RING_SIZE);
+        printf("Frame perf over %lu frames:\n", (unsigned long)s.frames);
+        printf("  busy us min %lu avg %lu p99 %lu max %lu\n", (unsigned long)s.busyMinUs, (unsigned long)s.busyAvgUs,
+               (unsigned long)s.busyP99Us, (unsigned long)s.busyMaxUs);
+        printf("  wait us min %lu avg %lu p99 %lu\n", (unsigned long)s.waitMinUs, (unsigned long)s.waitAvgUs,
+               (unsigned long)s.waitP99Us);
+        printf("  vsync misses %lu, audio underruns %lu, overruns %lu\n", (unsigned long)s.vsyncMisses,
+               (unsigned long)s.audioUnderruns, (unsigned long)s.audioOverruns);
+        printf("  core0 busy %d.%d%%", s.core0BusyPermille / 10, s.core0BusyPermille % 10);
+        if (s.core1BusyPermille >= 0)
+        {
+            printf(", core1 busy %d.%d%%", s.core1BusyPermille / 10, s.core1BusyPermille % 10);
+        }
+        printf("\n");
+#if HSTX
+        video_output_line_stats_t ls;
+        video_output_get_line_stats(&ls);
+        if (ls.line_period_cycles)
+        {
+            static const char *const causes[] = {"psram", "flash", "other"};
+            printf("  lines %lu, period %lu cycles, worst %lu (line %lu, callback %lu), slack %ld\n",
+                   (unsigned long)ls.lines, (unsigned long)ls.line_period_cycles, (unsigned long)ls.max_cycles,
+                   (unsigned long)ls.worst_line, (unsigned long)ls.max_callback_cycles, (long)ls.min_slack_cycles);
+            printf("  late lines %lu (psram %lu, flash %lu, other %lu), near misses %lu\n", (unsigned long)ls.late,
+                   (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_PSRAM],
+                   (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_FLASH],
+                   (unsigned long)ls.late_by_cause[VIDEO_OUTPUT_LATE_OTHER], (unsigned long)ls.near_misses);
+            video_output_late_line_t late[VIDEO_OUTPUT_LATE_LINE_LOG];
+            int n = video_output_get_late_lines(late, VIDEO_OUTPUT_LATE_LINE_LOG);
+            for (int i = 0; i < n; i++)
+            {
+                printf("    at cycle %lu line %u: %lu cycles, %s\n", (unsigned long)late[i].cycle, late[i].line,
+                       (unsigned long)late[i].cycles, causes[late[i].cause]);
+            }
+        }
+#endif
+        // Busy time histogram, last bucket collects everything above
+        uint16_t histogram[FRAMEPERF_HISTOGRAM_BUCKETS] = {0};
+        FramePerfRecord r;
+        for (int age = 0; getFramePerfRecord(age, r); age++)
+        {
+            histogram[std::min<int>(r.busyUs / FRAMEPERF_HISTOGRAM_BUCKET_US, FRAMEPERF_HISTOGRAM_BUCKETS - 1)]++;
+        }
+        for (int i = 0; i < FRAMEPERF_HISTOGRAM_BUCKETS; i++)
+        {
+            if (histogram[i])
+            {
+                printf("  %2d ms%s: %u\n", i * FRAMEPERF_HISTOGRAM_BUCKET_US / 1000,
+                       i == FRAMEPERF_HISTOGRAM_BUCKETS - 1 ? "+" : " ", histogram[i]);
+            }
+        }
+        if (!path)
+        {
+            return;
+        }
+        FIL fil;
+        FRESULT fr = f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS);
+        if (fr != FR_OK)
+        {
+            printf("Error opening %s: %d\n", path, fr);
+            return;
+        }
+        f_puts("frame,busy_us,wait_us,vsync_misses,audio_underruns,audio_overruns,core1_busy_pct\n", &fil);
+        int n = 0;
+        // Oldest record first
+        for (int age = FRAMEPERF_RING_SIZE - 1; age >= 0; age--)
+        {
+            if (!getFramePerfRecord(age, r))
+            {
+                continue;
+            }
+            char line[64];
+            snprintf(line, sizeof(line), "%d,%u,%u,%u,%u,%u,%d\n", n++, r.busyUs, r.waitUs, r.vsyncMisses,
+                     r.audioUnderruns, r.audioOverruns, r.core1Busy == 255 ? -1 : r.core1Busy);
+            if (f_puts(line, &fil) < 0)
+            {
+                fr = FR_DISK_ERR;
+                break;
+            }
+        }
+        f_close(&fil);
+        if (fr != FR_OK)
+        {
+            printf("Error writing %s: %d\n", path, fr);
+        }
+        else
+        {
+            printf("Frame perf written to %s (%d frames)\n", path, n);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+
+// Per-frame performance recorder and overlay.
+//
+// Every time PaceFrames60fps or waitForVSync returns, a record for the frame
+// that just ended goes into a fixed-size ring: the time the emulator was busy
+// since the previous return, the time spent waiting, display frames missed,
+// audio underruns/overruns and core1 busy time. Recording is a handful of
+// stores per frame; min/avg/p99 and the histogram are only computed when a
+// summary, the overlay text or a dump is requested.
+//
+// An emulator calls one of PaceFrames60fps / waitForVSync once per frame.
+#ifndef FRAMEPERF_RING_SIZE
+#define FRAMEPERF_RING_SIZE 256 // frames, power of two
+#endif
+// The overlay text is refreshed every FRAMEPERF_OVERLAY_INTERVAL frames
+#define FRAMEPERF_OVERLAY_INTERVAL 30
+// The fifth row shows the HSTX line-deadline monitor: the worst line's IRQ
+// time in percent of the line period and the late lines by cause (PSRAM,
+// flash, other)
+#define FRAMEPERF_OVERLAY_ROWS 5
+#define FRAMEPERF_OVERLAY_COLS 30
+// Busy time histogram bucket width in the dump
+#define FRAMEPERF_HISTOGRAM_BUCKET_US 1000
+#define FRAMEPERF_HISTOGRAM_BUCKETS 32
+
+namespace Frens
+{
+    struct FramePerfRecord
+    {
+        uint16_t busyUs;        // emulation and rendering, saturates at 65535
+        uint16_t waitUs;        // waiting for the next frame
+        uint8_t vsyncMisses;    // display frames missed before this one
+        uint8_t audioUnderruns; // saturate at 255
+        uint8_t audioOverruns;
+        uint8_t core1Busy;      // percent, 255 = not measured
+    };
+
+    struct FramePerfSummary
+    {
+        uint32_t frames; // records the summary covers
+        uint32_t busyMinUs, busyAvgUs, busyP99Us, busyMaxUs;
+        uint32_t waitMinUs, waitAvgUs, waitP99Us;
+        uint32_t vsyncMisses;
+        uint32_t audioUnderruns;
+        uint32_t audioOverruns;
+        int core0BusyPermille; // share of frame time not spent waiting
+        int core1BusyPermille; // -1 when not measured (PicoDVI)
+    };
+
+    // Called by the frame pacer when a frame ends.
+    void framePerfEndFrame(uint32_t busyUs, uint32_t waitUs, uint32_t vsyncMisses);
+    // Audio output code reports buffer underruns / overruns. On HSTX the HDMI
+    // audio queue counters are picked up automatically.
+    void framePerfAudioUnderrun(uint32_t count = 1);
+    void framePerfAudioOverrun(uint32_t count = 1);
+    // Summary over the last frames records (at most FRAMEPERF_RING_SIZE).
+    void getFramePerfSummary(FramePerfSummary &summary, int frames = FRAMEPERF_RING_SIZE);
+    // Copies record age (0 = most recent frame), returns false when there is no such record.
+    bool getFramePerfRecord(int age, FramePerfRecord &record);
+    // Clears the records; the frame after a reset is not recorded, it straddles the reset.
+    void resetFramePerf();
+    // Overlay in the top left corner, white on black, 8x8 font.
+    void setFramePerfOverlay(bool enabled);
+    bool isFramePerfOverlayEnabled();
+    // Draws the overlay part of one scanline into a line of 16-bit pixels;
+    // use this from a scanline callback. Lines outside the overlay are left alone.
+    void drawFramePerfOverlayLine(int line, uint16_t *dst, int width);
+    // Draws the overlay into a 16-bit framebuffer, stride in pixels.
+    void drawFramePerfOverlay(uint16_t *framebuffer, int width, int height, int stride);
+    // Prints the summary and busy time histogram to the serial console. With a
+    // path, also writes all records as CSV to that file on the SD card.
+    void dumpFramePerf(const char *path = nullptr);
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico.h"
+#include "FrensHelpers.h"
+#include "settings.h"
+#include "FrameSkip.h"
+
+namespace Frens
+{
+#if HSTX
+    static int (*fillQuery)(void) = getAudioOutputFillPermille;
+#else
+    static int (*fillQuery)(void) = nullptr;
+#endif
+    static int maxConsecutiveSkips = FRAMESKIP_MAX_CONSECUTIVE;
+    static FrameSkipStats skipStats;
+    static uint32_t budgetUs = 16715;
+    static bool skipping = false;       // governor state, with hysteresis
+    static bool lastFrameSkipped = false;
+    static uint32_t consecutiveSkips = 0;
+
+    // Running average with weight 1/8, in microseconds
+    static inline void ewma(uint32_t &avg, uint32_t sample)
+    {
+        avg = avg ? avg + ((int32_t)(sample - avg) >> 3) : sample;
+    }
+
+    void frameSkipFramePaced(uint32_t busyUs, uint32_t periodUs)
+    {
+        budgetUs = periodUs;
+        skipStats.frames++;
+        if (busyUs > periodUs)
+        {
+            skipStats.deadlineMisses++;
+        }
+        ewma(lastFrameSkipped ? skipStats.skipUs : skipStats.renderUs, busyUs);
+        lastFrameSkipped = false;
+    }
+
+    bool shouldSkipFrame()
+    {
+        if (!settings.flags.frameSkip)
+        {
+            skipping = false;
+            consecutiveSkips = 0;
+            return false;
+        }
+        int fill = fillQuery ? fillQuery() : -1;
+        uint32_t predicted = skipStats.renderUs;
+        bool behind = predicted > budgetUs || (fill >= 0 && fill < FRAMESKIP_FILL_LOW);
+        bool caughtUp = predicted * 10 < budgetUs * 9 && (fill < 0 || fill > FRAMESKIP_FILL_HIGH);
+        if (!skipping && behind)
+        {
+            skipping = true;
+        }
+        else if (skipping && caughtUp)
+        {
+            skipping = false;
+        }
+        // A rendered frame now and then also keeps the render time estimate current.
+        bool skip = skipping && consecutiveSkips < (uint32_t)maxConsecutiveSkips;
+        if (skip)
+        {
+            consecutiveSkips++;
+            skipStats.skipped++;
+            if (consecutiveSkips > skipStats.maxConsecutive)
+            {
+                skipStats.maxConsecutive = consecutiveSkips;
+            }
+        }
+        else
+        {
+            consecutiveSkips = 0;
+        }
+        lastFrameSkipped = skip;
+        return skip;
+    }
+
+    void setFrameSkipMaxConsecutive(int maxConsecutive)
+    {
+        maxConsecutiveSkips = maxConsecutive < 0 ? 0 : maxConsecutive;
+    }
+
+    void setFrameSkipFillQuery(int (*query)(void))
+    {
+        fillQuery = query;
+    }
+
+    void getFrameSkipStats(FrameSkipStats &stats)
+    {
+        stats = skipStats;
+    }
+
+    void resetFrameSkipStats()
+    {
+        memset(&skipStats, 0, sizeof(skipStats));
+        skipping = false;
+        consecutiveSkips = 0;
+    }
+}
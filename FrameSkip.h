@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// Closed-loop frame-skip governor.
+//
+// PaceFrames60fps measures how long the emulator was busy between two calls
+// (emulation plus rendering) and keeps a running average for rendered and for
+// skipped frames. shouldSkipFrame(), called once per frame before rendering,
+// skips only when a rendered frame is predicted to overrun the frame period or
+// the audio buffer is running low. It enters skipping at the deadline and
+// leaves it only with margin to spare (hysteresis), and never skips more than
+// maxConsecutive frames in a row. Only active when settings.flags.frameSkip is set.
+#ifndef FRAMESKIP_MAX_CONSECUTIVE
+#define FRAMESKIP_MAX_CONSECUTIVE 3
+#endif
+// Audio fill levels in permille: below LOW counts as behind, skipping stops
+// only when the buffer is back above HIGH.
+#define FRAMESKIP_FILL_LOW 250
+#define FRAMESKIP_FILL_HIGH 400
+
+namespace Frens
+{
+    struct FrameSkipStats
+    {
+        uint32_t frames;         // frames paced since the last reset
+        uint32_t skipped;        // frames for which shouldSkipFrame() returned true
+        uint32_t deadlineMisses; // frames busy for longer than the frame period
+        uint32_t maxConsecutive; // longest run of skipped frames
+        uint32_t renderUs;       // average busy time of a rendered frame
+        uint32_t skipUs;         // average busy time of a skipped frame
+    };
+
+    // Returns true when the emulator should skip rendering the current frame.
+    bool shouldSkipFrame();
+    void setFrameSkipMaxConsecutive(int maxConsecutive);
+    // Audio fill level query in permille (0..1000), -1 when unknown. Defaults to
+    // getAudioOutputFillPermille() on HSTX and to the setAudioPaceQuery() query
+    // on DVI.
+    void setFrameSkipFillQuery(int (*query)(void));
+    void getFrameSkipStats(FrameSkipStats &stats);
+    void resetFrameSkipStats();
+    // Called by PaceFrames60fps with the busy time of the frame that just ended
+    // and the current frame period.
+    void frameSkipFramePaced(uint32_t busyUs, uint32_t periodUs);
+}
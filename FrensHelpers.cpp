@@ -12,6 +12,9 @@
 #endif
 #include "util/exclusive_proc.h"
 #include "FrensHelpers.h"
+#include "IdleTasks.h"
+#include "FrameSkip.h"
+#include "FramePerf.h"
 #if CFG_TUH_RPI_PIO_USB && PICO_RP2350
 #include "bsp/board_api.h"
 #include "board.h"
@@ -47,7 +50,27 @@
 std::unique_ptr<dvi::DVI> dvi_;
 util::ExclusiveProc exclProc_;
 static volatile bool vsync = false;
-static void (*vsyncWaitTask)(void) = nullptr;
+// Incremented by core1 each time it raises vsync, followed by __sev() so a
+// core0 waiter sleeping in WFE wakes up. Waiting on a change of the count
+// instead of the flag cannot miss the short window in which vsync is true.
+static volatile uint32_t vsyncCount = 0;
+// time_us_32() of the last vsync and the measured frame period, used as the
+// deadline for idle tasks while waiting for the next vsync.
+static volatile uint32_t vsyncTimeUs = 0;
+static volatile uint32_t vsyncPeriodUs = 16667;
+static inline void signalVSync()
+{
+    uint32_t now = time_us_32();
+    uint32_t period = now - vsyncTimeUs;
+    if (period > 10000 && period < 30000)
+    {
+        vsyncPeriodUs = period;
+    }
+    vsyncTimeUs = now;
+    vsync = true;
+    vsyncCount = vsyncCount + 1;
+    __sev();
+}
 // Returns the active audio output buffer's fill level in permille (0..1000).
 // When set, PaceFrames locks the frame rate to that buffer draining to ~half,
 // i.e. to the audio-consumption clock. nullptr → fall back to timer pacing.
@@ -63,6 +86,21 @@ static bool paceTimerInited = false;
 static volatile Frens::LineStreamFillFn lineStreamFill_ = nullptr;
 static volatile bool lineStreamActive_ = false;
 static uint16_t *lineStreamScratch_ = nullptr;
+// Batched line-stream: one batch of LINESTREAM_MAX_BATCH lines, which core1
+// fills and then converts. Both run on core1, so a second batch would have
+// nothing to overlap with. Only the optional prefetch buffer has two halves:
+// the DMA (lineStreamPrefetchChan_) copies the next batch's raw source rows
+// into one while core1 works from the other.
+static volatile Frens::LineStreamBatchFillFn lineStreamBatchFill_ = nullptr;
+static volatile int lineStreamBatch_ = LINESTREAM_MAX_BATCH;
+static uint16_t *lineStreamBatchBuf_ = nullptr;
+static const uint8_t *lineStreamPrefetchSrc_ = nullptr;
+static uint32_t lineStreamPrefetchRowBytes_ = 0;
+static uint32_t lineStreamPrefetchStride_ = 0;
+static uint8_t *lineStreamPrefetchBuf_ = nullptr;
+static uint32_t lineStreamPrefetchBufSize_ = 0;
+static int lineStreamPrefetchChan_ = -1;
+static volatile uint32_t lineStreamFillUs_ = 0;
 #endif
 char ErrorMessage[ERRORMESSAGESIZE];
 bool scaleMode8_7_ = true;
@@ -77,6 +115,29 @@ namespace Frens
     static DWORD totalSpace = 0;
     static DWORD freeSpace = 0;
     static bool extSpeakerEnabled = false;
+    // Idle task registered through setVSyncWaitTask()
+    static int vsyncWaitTaskId = -1;
+
+    // Exact frame pacing: the frame period den * 1e6 / num is kept as whole
+    // microseconds plus a remainder that is accumulated in units of 1/num µs.
+    static FrameRate frameRate = FrameRates::PCE_NTSC;
+    static uint32_t framePeriodUs = (uint32_t)((uint64_t)FrameRates::PCE_NTSC.den * 1000000u / FrameRates::PCE_NTSC.num);
+    static uint32_t framePeriodRem = (uint32_t)((uint64_t)FrameRates::PCE_NTSC.den * 1000000u % FrameRates::PCE_NTSC.num);
+    static uint32_t framePeriodAccum = 0;
+    static FramePaceStats paceStats;
+    static uint32_t paceAnchorUs = 0;   // wall time of the last resync
+    static uint64_t paceIdealUs = 0;    // ideal time elapsed since paceAnchorUs
+    static uint32_t paceStatsAccum = 0; // fractional part for paceIdealUs
+    // Return time of the previous PaceFrames60fps / waitForVSync; the emulator
+    // was busy from there until the next call.
+    static uint32_t lastFrameEndUs = 0;
+    static uint32_t lastVSyncFrame = 0;
+
+    // Idle accounting: time core0 spends waiting for the next frame, minus the
+    // time the wait task used, reported per one second window.
+    static uint32_t idleWindowStart = 0;
+    static uint32_t idleUsInWindow = 0;
+    static int idlePermille = -1;
 
     // pico_emuLoader bootloader handshake. Two watchdog scratch registers
     // carry one-direction signals between the resident bootloader and the
@@ -140,6 +201,8 @@ namespace Frens
      // casts this buffer to uint32_t* and reads it with ldmia, which hard-faults
      // on Cortex-M if the base is not 4-byte aligned. Plain uint16_t arrays only
      // get 2-byte alignment, so the fault depends on .bss layout (HW_CONFIG).
+     // Stays in SRAM even with PSRAM present: core1 encodes straight from it,
+     // there is no row prefetch on this path (HSTX_FRAMEBUFFER_PSRAM is HSTX only).
      alignas(uint32_t) WORD framebuffer[SCREENWIDTH * SCREENHEIGHT];
 #endif
    
@@ -251,41 +314,252 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
     capacity = 1 << rxbuf[3];
     return capacity;
 }
-#if !HSTX
-    /// @brief Wait for vertical sync
-    void setVSyncWaitTask(void (*task)(void))
+    // Adds a finished wait to the idle statistics and closes the one second
+    // reporting window when it has elapsed.
+    static void accountIdle(uint32_t waitStart, uint32_t taskUs)
+    {
+        uint32_t now = time_us_32();
+        uint32_t waited = now - waitStart;
+        idleUsInWindow += waited > taskUs ? waited - taskUs : 0;
+        uint32_t elapsed = now - idleWindowStart;
+        if (elapsed >= 1000000)
+        {
+            idlePermille = idleWindowStart ? (int)((uint64_t)idleUsInWindow * 1000 / elapsed) : -1;
+            idleWindowStart = now;
+            idleUsInWindow = 0;
+        }
+    }
+
+    // One iteration of a wait loop: run an idle task that fits before the
+    // deadline, or sleep until the next event. Core1 signals frame boundaries
+    // with __sev(), and any interrupt on core0 (USB, audio DMA, timers) wakes
+    // it as well.
+    static inline void idleWait(uint32_t deadlineUs)
+    {
+        if (!runIdleTasks(deadlineUs))
+        {
+            __wfe();
+        }
+    }
+
+    void setFrameRate(FrameRate rate)
+    {
+        if (rate.num == 0 || rate.den == 0)
+        {
+            return;
+        }
+        uint64_t period = (uint64_t)rate.den * 1000000u;
+        frameRate = rate;
+        framePeriodUs = (uint32_t)(period / rate.num);
+        framePeriodRem = (uint32_t)(period % rate.num);
+        framePeriodAccum = 0;
+        paceStatsAccum = 0;
+#if HSTX
+        hstx_setFrameRate(rate.num, rate.den);
+#else
+        paceTimerInited = false;
+#endif
+        printf("Frame rate set to %lu/%lu Hz, period %lu + %lu/%lu us\n", (unsigned long)rate.num, (unsigned long)rate.den,
+               (unsigned long)framePeriodUs, (unsigned long)framePeriodRem, (unsigned long)rate.num);
+    }
+
+    FrameRate getFrameRate()
+    {
+        return frameRate;
+    }
+
+    static bool displayRefresh50Hz = false;
+    void setDisplayRefresh50Hz(bool enable)
+    {
+        displayRefresh50Hz = enable;
+#if HSTX
+        // A 240p/480p switch may still be pending; keep the resolution it asked for
+        switch (video_output_get_requested_mode())
+        {
+        case VIDEO_OUTPUT_MODE_640x480:
+        case VIDEO_OUTPUT_MODE_640x480_50:
+            video_output_set_mode(enable ? VIDEO_OUTPUT_MODE_640x480_50 : VIDEO_OUTPUT_MODE_640x480);
+            break;
+        default:
+            video_output_set_mode(enable ? VIDEO_OUTPUT_MODE_1280x240_50 : VIDEO_OUTPUT_MODE_1280x240);
+            break;
+        }
+#endif
+    }
+
+    bool isDisplayRefresh50Hz()
+    {
+        return displayRefresh50Hz;
+    }
+
+    // Length of the next frame in whole microseconds; the fractional parts add
+    // up to an extra microsecond every num / rem frames.
+    static inline uint32_t nextFramePeriodUs(uint32_t &accum)
+    {
+        accum += framePeriodRem;
+        if (accum >= frameRate.num)
+        {
+            accum -= frameRate.num;
+            return framePeriodUs + 1;
+        }
+        return framePeriodUs;
+    }
+
+    void getFramePaceStats(FramePaceStats &stats)
+    {
+        stats = paceStats;
+    }
+
+    void resetFramePaceStats()
+    {
+        memset(&paceStats, 0, sizeof(paceStats));
+        paceAnchorUs = time_us_32();
+        paceIdealUs = 0;
+    }
+
+    // Updates the pacing statistics after a frame was released. dropped > 0
+    // means the pacer resynced after an overrun. Drift is only meaningful when
+    // the frame was paced to frameRate; frames locked to the display's vsync
+    // or to the audio clock restart the measurement instead.
+    static void updatePaceStats(bool init, int dropped, bool pacedToFrameRate)
+    {
+        uint32_t now = time_us_32();
+        paceStats.frames++;
+        if (init || dropped > 0 || !pacedToFrameRate)
+        {
+            if (!init)
+            {
+                paceStats.overruns++;
+                paceStats.droppedFrames += dropped;
+            }
+            paceAnchorUs = now;
+            paceIdealUs = 0;
+            paceStats.driftUs = 0;
+            return;
+        }
+        paceIdealUs += nextFramePeriodUs(paceStatsAccum);
+        int32_t drift = (int32_t)((int64_t)(now - paceAnchorUs) - (int64_t)paceIdealUs);
+        paceStats.driftUs = drift;
+        int32_t absDrift = drift < 0 ? -drift : drift;
+        if (absDrift > paceStats.maxDriftUs)
+        {
+            paceStats.maxDriftUs = absDrift;
+        }
+    }
+
+    int getIdlePermille()
     {
-        vsyncWaitTask = task;
+        return idlePermille;
     }
 
+#ifndef AUDIO_IDLE_TIMEOUT_US
+#define AUDIO_IDLE_TIMEOUT_US 100000
+#endif
+    int getAudioOutputFillPermille()
+    {
+        int fill = -1;
+#if HSTX
+        if (!settings.flags.useExtAudio && !isHeadPhoneJackConnected())
+        {
+            uint32_t packets = hstx_audio_queued_packets() * 1000 / HSTX_AUDIO_DI_HIGH_WATERMARK;
+            fill = packets > 1000 ? 1000 : (int)packets;
+        }
+        else
+#endif
+        {
+#if USE_I2S_AUDIO && !USE_PICO_EXTRAS_I2S
+            fill = audio_i2s_get_fill_permille();
+#endif
+        }
+        // Producers queue at least a block at a time, so a flowing output is
+        // only seen empty briefly.
+        static bool flowing = false;
+        static uint32_t lastFilledUs;
+        uint32_t now = time_us_32();
+        if (fill > 0)
+        {
+            flowing = true;
+            lastFilledUs = now;
+        }
+        else if (fill == 0 && flowing && now - lastFilledUs > AUDIO_IDLE_TIMEOUT_US)
+        {
+            flowing = false;
+        }
+        return fill == 0 && !flowing ? -1 : fill;
+    }
+
+    /// @brief Registers task as a high priority idle task, replacing the previous one.
+    /// Its slice is the longest run measured so far.
+    void setVSyncWaitTask(void (*task)(void))
+    {
+        removeIdleTask(vsyncWaitTaskId);
+        vsyncWaitTaskId = task ? addIdleTask(task, IDLE_PRIORITY_HIGH, 0, "vsyncWaitTask") : -1;
+    }
+#if !HSTX
     void setAudioPaceQuery(int (*query)(void))
     {
         audioFillQuery = query;
         paceTimerInited = false;
+        // The frame-skip governor watches the same buffer
+        setFrameSkipFillQuery(query);
+    }
+
+    // Waits until core1 finishes its next pass over the frame.
+    static void waitForVSyncSignal()
+    {
+        uint32_t count = vsyncCount;
+        while (vsyncCount == count)
+        {
+            idleWait(vsyncTimeUs + vsyncPeriodUs);
+        }
     }
 #endif
+    // Display frames seen by the frame waits, used to count vsync misses.
+    static inline uint32_t displayFrameCount()
+    {
+#if !HSTX
+        return vsyncCount;
+#else
+        return hstx_getframecounter();
+#endif
+    }
+
     void waitForVSync()
     {
+        uint32_t waitStart = time_us_32();
+        // The first wait has no previous frame to measure, only sync to the display
+        bool firstFrame = lastFrameEndUs == 0;
+        uint32_t busyUs = firstFrame ? 0 : waitStart - lastFrameEndUs;
+        uint64_t taskUs = getIdleTasksTotalUs();
 #if !HSTX
         // Framebuffer path and line-stream path both drive `vsync` from core1
         // at frame boundaries; wait for it so core0 stays frame-locked.
         if (Frens::isFrameBufferUsed() || lineStreamActive_)
         {
-            while (vsync == false)
-            {
-                // busy wait
-                tight_loop_contents();
-            }
+            waitForVSyncSignal();
         }
 #else
         hstx_waitForVSync();
 #endif
+        accountIdle(waitStart, (uint32_t)(getIdleTasksTotalUs() - taskUs));
+        uint32_t frame = displayFrameCount();
+        uint32_t advanced = frame - lastVSyncFrame;
+        lastVSyncFrame = frame;
+        lastFrameEndUs = time_us_32();
+        if (!firstFrame)
+        {
+            framePerfEndFrame(busyUs, lastFrameEndUs - waitStart, advanced > 1 ? advanced - 1 : 0);
+        }
     }
 #if 1
     /// @brief Poor way to pace frames to 60fps
     /// @param init
-    void PaceFrames60fps(bool init, bool usePicoDVIvsyncWait)
+    /// Returns the number of frames dropped to resync after an overrun.
+    /// pacedToFrameRate is set when the frame was paced to frameRate rather
+    /// than to the display's vsync or the audio clock.
+    static int paceFrame(bool init, bool usePicoDVIvsyncWait, bool &pacedToFrameRate)
     {
+        pacedToFrameRate = false;
 #if !HSTX
 #if USE_PCE_FRAMEBUFFER_PACING
         // Buffer pacing for pico-pcePlus
@@ -297,17 +571,19 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
             // otherwise sreensaver will run too fast.
             if (usePicoDVIvsyncWait)
             {
-                while (vsync == false)
-                {
-                    // busy wait
-                    tight_loop_contents();
-                }
-                return;
+                waitForVSyncSignal();
+                return 0;
             }
+            int dropped = 0;
+            // Frame period, also the deadline for idle tasks when pacing to audio.
+            static uint32_t frameStartUs;
+            uint32_t frameDeadlineUs = frameStartUs + framePeriodUs;
             // CD games prefetch a sector every frame, regardless of which
-            // pacing path runs below, so the CD audio ring never starves.
-            if (vsyncWaitTask)
-                vsyncWaitTask();
+            // pacing path runs below, so the CD audio ring never starves:
+            // when nothing fits in the remaining slack, one task still gets
+            // a frame's worth of time.
+            if (!runIdleTasks(frameDeadlineUs))
+                runIdleTasks(time_us_32() + framePeriodUs);
 
             if (audioFillQuery)
             {
@@ -321,10 +597,10 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
                 // cushions brief sub-60fps dips; the >60fps catch-up refills it.
                 while (audioFillQuery() > 500)
                 {
-                    if (vsyncWaitTask)
-                        vsyncWaitTask();
-                    else
-                        tight_loop_contents();
+                    // The HDMI audio ring drains on core1 without waking core0,
+                    // so sleep at most 200us between polls.
+                    if (!runIdleTasks(frameDeadlineUs))
+                        best_effort_wfe_or_timeout(make_timeout_time_us(200));
                 }
             }
             else
@@ -332,44 +608,73 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
                 // Menu / non-CD: slack-aware timer pacing (no continuous audio
                 // stream to lock onto). Resync on overrun so a slow frame can't
                 // harmonic-lock the loop to 30fps.
+                // The period comes from setFrameRate(), whole microseconds
+                // plus an accumulated fraction so the rate does not drift.
                 static absolute_time_t next_frame;
-                // True PCE NTSC frame period: 1/59.826 ≈ 16715 µs (not 60 Hz).
                 if (init || !paceTimerInited)
                 {
-                    next_frame = make_timeout_time_us(16715);
+                    framePeriodAccum = 0;
+                    next_frame = make_timeout_time_us(nextFramePeriodUs(framePeriodAccum));
                     paceTimerInited = true;
                 }
                 if (time_reached(next_frame))
                 {
-                    next_frame = make_timeout_time_us(16715);
+                    next_frame = make_timeout_time_us(nextFramePeriodUs(framePeriodAccum));
+                    dropped = 1;
                 }
                 else
                 {
                     while (!time_reached(next_frame))
                     {
-                        if (vsyncWaitTask)
-                            vsyncWaitTask(); // keep prefetching CD audio
-                        else
-                            tight_loop_contents();
+                        // keep prefetching CD audio
+                        if (!runIdleTasks((uint32_t)to_us_since_boot(next_frame)))
+                            best_effort_wfe_or_timeout(next_frame);
                     }
-                    next_frame = delayed_by_us(next_frame, 16715);
+                    uint32_t late = (uint32_t)absolute_time_diff_us(next_frame, get_absolute_time());
+                    if (late > paceStats.maxLateUs)
+                    {
+                        paceStats.maxLateUs = late;
+                    }
+                    next_frame = delayed_by_us(next_frame, nextFramePeriodUs(framePeriodAccum));
                 }
+                pacedToFrameRate = true;
             }
+            frameStartUs = time_us_32();
+            return dropped;
         }
 #else
         if (Frens::isFrameBufferUsed())
         {
-            while (vsync == false)
-            {
-                // busy wait
-                tight_loop_contents();
-            }
+            waitForVSyncSignal();
         }
 #endif
+        return 0;
 #else
-        hstx_paceFrame(init);
+        pacedToFrameRate = true;
+        return hstx_paceFrame(init);
 #endif
     }
+
+    void PaceFrames60fps(bool init, bool usePicoDVIvsyncWait)
+    {
+        uint32_t waitStart = time_us_32();
+        uint32_t busyUs = lastFrameEndUs ? waitStart - lastFrameEndUs : 0;
+        if (!init && lastFrameEndUs)
+        {
+            frameSkipFramePaced(busyUs, framePeriodUs);
+        }
+        uint64_t taskUs = getIdleTasksTotalUs();
+        bool pacedToFrameRate;
+        int dropped = paceFrame(init, usePicoDVIvsyncWait, pacedToFrameRate);
+        accountIdle(waitStart, (uint32_t)(getIdleTasksTotalUs() - taskUs));
+        updatePaceStats(init, dropped, pacedToFrameRate);
+        lastVSyncFrame = displayFrameCount();
+        lastFrameEndUs = time_us_32();
+        if (!init)
+        {
+            framePerfEndFrame(busyUs, lastFrameEndUs - waitStart, dropped > 0 ? dropped : 0);
+        }
+    }
 #endif
     //
     //
@@ -1268,6 +1573,62 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
         }
     }
 #if !HSTX
+    // Starts the DMA copy of source row line into row index of prefetch half slot.
+    static inline void __not_in_flash_func(prefetchLineStreamRow)(int line, int slot, int index)
+    {
+        uint32_t rowBytes = lineStreamPrefetchRowBytes_;
+        uint8_t *dst = lineStreamPrefetchBuf_ + (slot * LINESTREAM_MAX_BATCH + index) * rowBytes;
+        const uint8_t *src = lineStreamPrefetchSrc_ + line * lineStreamPrefetchStride_;
+        dma_channel_set_write_addr(lineStreamPrefetchChan_, dst, false);
+        dma_channel_transfer_from_buffer_now(lineStreamPrefetchChan_, src, rowBytes / 4);
+    }
+
+    // One frame of the batched line stream. The fill of a batch is followed by
+    // the conversion of its lines, both on core1 and into the same batch
+    // buffer. Only the prefetch runs alongside: during each conversion the DMA
+    // copies one source row of the next batch, so the rows are in SRAM by the
+    // time that batch is filled.
+    static void __not_in_flash_func(streamBatchedFrame)(Frens::LineStreamBatchFillFn fn)
+    {
+        const int k = lineStreamBatch_;
+        const bool prefetch = lineStreamPrefetchSrc_ && lineStreamPrefetchChan_ >= 0;
+        uint32_t fillUs = 0;
+        if (prefetch)
+        {
+            for (int i = 0; i < k; i++)
+            {
+                prefetchLineStreamRow(i, 0, i);
+                dma_channel_wait_for_finish_blocking(lineStreamPrefetchChan_);
+            }
+        }
+        for (int first = 0; first < SCREENHEIGHT; first += k)
+        {
+            int count = std::min(k, SCREENHEIGHT - first);
+            int slot = (first / k) & 1;
+            uint16_t *dst = lineStreamBatchBuf_;
+            const uint8_t *rows = nullptr;
+            if (prefetch)
+            {
+                dma_channel_wait_for_finish_blocking(lineStreamPrefetchChan_);
+                rows = lineStreamPrefetchBuf_ + slot * LINESTREAM_MAX_BATCH * lineStreamPrefetchRowBytes_;
+            }
+            uint32_t t = time_us_32();
+            fn(first, count, dst, rows);
+            fillUs += time_us_32() - t;
+            int next = first + k;
+            for (int i = 0; i < count; i++)
+            {
+                if (prefetch && next + i < SCREENHEIGHT)
+                {
+                    dma_channel_wait_for_finish_blocking(lineStreamPrefetchChan_);
+                    prefetchLineStreamRow(next + i, slot ^ 1, i);
+                }
+                dvi_->convertScanBuffer12bpp(first + i, dst + i * 640, 640);
+            }
+        }
+        lineStreamFillUs_ = fillUs;
+    }
+
     /// @brief Render function in core1 to render line by line
     /// @param
     /// @return
@@ -1278,14 +1639,22 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
             dvi_->registerIRQThisCore();
             // Line-stream mode has no producer queue to wait on; only the
             // default queue model needs a first valid line before starting.
-            if (!lineStreamFill_)
+            if (!lineStreamFill_ && !lineStreamBatchFill_)
                 dvi_->waitForValidLine();
 
             dvi_->start();
             while (!exclProc_.isExist())
             {
+                Frens::LineStreamBatchFillFn batchFn = lineStreamBatchFill_;
                 Frens::LineStreamFillFn fn = lineStreamFill_;
-                if (fn)
+                if (batchFn)
+                {
+                    lineStreamActive_ = true;
+                    vsync = false;
+                    streamBatchedFrame(batchFn);
+                    signalVSync();
+                }
+                else if (fn)
                 {
                     // Line-stream mode: read each line via the callback into the
                     // scratch buffer and stream it straight to the DMA. The
@@ -1296,12 +1665,16 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
                     // stay ahead of the read -> no crawling tear seam.
                     lineStreamActive_ = true;
                     vsync = false;
+                    uint32_t fillUs = 0;
                     for (int line = 0; line < SCREENHEIGHT; ++line)
                     {
+                        uint32_t t = time_us_32();
                         fn(line, lineStreamScratch_);
+                        fillUs += time_us_32() - t;
                         dvi_->convertScanBuffer12bpp(line, lineStreamScratch_, 640);
                     }
-                    vsync = true;
+                    lineStreamFillUs_ = fillUs;
+                    signalVSync();
                 }
                 else if (scaleMode8_7_)
                 {
@@ -1341,6 +1714,66 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
         lineStreamFill_ = fn;
     }
 
+    void setLineStreamBatchFill(LineStreamBatchFillFn fn, int linesPerBatch)
+    {
+        if (fn && !lineStreamBatchBuf_)
+        {
+            // Kept allocated once used, like the per-line scratch
+            lineStreamBatchBuf_ = (uint16_t *)malloc(LINESTREAM_MAX_BATCH * 640 * sizeof(uint16_t));
+        }
+        if (fn && !lineStreamBatchBuf_)
+            return;
+        lineStreamBatch_ = std::max(1, std::min(linesPerBatch, LINESTREAM_MAX_BATCH));
+        lineStreamBatchFill_ = fn;
+    }
+
+    bool setLineStreamPrefetch(const void *source, uint32_t rowBytes, uint32_t rowStride)
+    {
+        if (lineStreamBatchFill_)
+        {
+            printf("setLineStreamPrefetch: clear the batch fill first\n");
+            return false;
+        }
+        if (!source)
+        {
+            lineStreamPrefetchSrc_ = nullptr;
+            return true;
+        }
+        // Whole words, the DMA copies 32 bits at a time
+        rowBytes = (rowBytes + 3) & ~3u;
+        uint32_t size = 2 * LINESTREAM_MAX_BATCH * rowBytes;
+        if (size > lineStreamPrefetchBufSize_)
+        {
+            free(lineStreamPrefetchBuf_);
+            lineStreamPrefetchBuf_ = (uint8_t *)malloc(size);
+            lineStreamPrefetchBufSize_ = lineStreamPrefetchBuf_ ? size : 0;
+        }
+        if (!lineStreamPrefetchBuf_)
+        {
+            lineStreamPrefetchSrc_ = nullptr;
+            return false;
+        }
+        if (lineStreamPrefetchChan_ < 0)
+        {
+            lineStreamPrefetchChan_ = GetUnUsedDMAChan(-1);
+            dma_channel_claim(lineStreamPrefetchChan_);
+            dma_channel_config c = dma_channel_get_default_config(lineStreamPrefetchChan_);
+            channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+            channel_config_set_read_increment(&c, true);
+            channel_config_set_write_increment(&c, true);
+            dma_channel_set_config(lineStreamPrefetchChan_, &c, false);
+        }
+        lineStreamPrefetchRowBytes_ = rowBytes;
+        lineStreamPrefetchStride_ = rowStride;
+        lineStreamPrefetchSrc_ = (const uint8_t *)source;
+        return true;
+    }
+
+    uint32_t getLineStreamFillUs()
+    {
+        return lineStreamFillUs_;
+    }
+
     bool lineStreamActive()
     {
         return lineStreamActive_;
@@ -1381,7 +1814,7 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
                     dvi_->convertScanBuffer12bpp(line, buffer, 640);
                 }
             }
-            vsync = true;
+            signalVSync();
         }
 #endif
     }
@@ -1542,8 +1975,12 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
     void initDVandAudio(int marginTop, int marginBottom, size_t audioBufferSize)
     {
 #if !HSTX
+        // 50 Hz: 105 more blank lines, 630 in total at the same pixel clock
+        static dvi_timing timing50Hz = dvi::getTiming640x480p60Hz();
+        timing50Hz.v_front_porch = 58;
+        timing50Hz.v_back_porch = 90;
         dvi_ = std::make_unique<dvi::DVI>(pio0, &DVICONFIG,
-                                          dvi::getTiming640x480p60Hz());
+                                          displayRefresh50Hz ? timing50Hz : dvi::getTiming640x480p60Hz());
 
 //    dvi_->setAudioFreq(48000, 25200, 6144);
 #if 0
@@ -1568,6 +2005,10 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
         // 空サンプル詰めとく
         dvi_->getAudioRingBuffer().advanceWritePointer(255);
 #else
+#if HSTX_FRAMEBUFFER_PSRAM
+        // Framebuffer in PSRAM when present, scanout prefetches its rows into SRAM
+        hstx_setFramebufferMemory((uint8_t *)f_malloc(HSTX_FRAMEBUFFER_BYTES));
+#endif
         hstx_init(settings.flags.useDVIModeForHDMI);
 #if 0
         // For now use an MCP4822 DAC for audio output
@@ -1925,15 +2366,62 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
 #endif
     }
 
-    FRESULT pick_random_file_fullpath(const char *dirpath, char *out_path, size_t out_size)
+    // Per-directory cache for pick_random_file_fullpath(). The first pick in a
+    // directory walks it once and stores the stems (name without FILEXTFORSEARCH)
+    // of the eligible files in a compact name pool. Later picks are a single
+    // rand() index into that pool, so no f_readdir/strcmp walk per pick.
+    // Slots are recycled least recently used first, and older slots are also
+    // dropped while the cache holds more than RANDOMFILECACHE_MAX_BYTES. The
+    // most recent directory is always kept, whatever its size.
+#define RANDOMFILECACHE_SLOTS 16
+#ifndef RANDOMFILECACHE_MAX_BYTES
+#define RANDOMFILECACHE_MAX_BYTES (16 * 1024)
+#endif
+    struct RandomFileDirCache
+    {
+        char *names;       // dirpath, followed by the NUL-terminated stems
+        uint32_t *offsets; // offset of each stem in names
+        uint16_t count;
+        uint32_t bytes;    // allocated for names and offsets
+        uint32_t lastUsed;
+    };
+    static RandomFileDirCache randomFileCache[RANDOMFILECACHE_SLOTS];
+    static uint32_t randomFileCacheTick = 0;
+    static uint32_t randomFileCacheBytes = 0;
+
+    static void freeRandomFileDirCache(RandomFileDirCache &slot)
+    {
+        if (slot.names)
+        {
+            Frens::f_free(slot.names);
+        }
+        if (slot.offsets)
+        {
+            Frens::f_free(slot.offsets);
+        }
+        randomFileCacheBytes -= slot.bytes;
+        slot = {};
+    }
+
+    void freeRandomFileCache()
+    {
+        for (auto &slot : randomFileCache)
+        {
+            freeRandomFileDirCache(slot);
+        }
+    }
+
+    static FRESULT buildRandomFileDirCache(const char *dirpath, RandomFileDirCache &slot)
     {
         static const int MAX_ITER = 504;
         FRESULT fr;
         DIR dir;
         FILINFO fno;
-        UINT file_count = 0;
         int iter = 0;
-        *out_path = 0;
+        size_t extLen = strlen(FILEXTFORSEARCH);
+        size_t poolSize = strlen(dirpath) + 1;
+        size_t poolCapacity = poolSize + 512;
+        size_t offsetCapacity = 64;
 
         fr = f_opendir(&dir, dirpath);
         if (fr != FR_OK)
@@ -1941,16 +2429,17 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
             printf("Error: Unable to open directory: %s, error code: %d\n", dirpath, fr);
             return fr;
         }
-
+        char *names = (char *)Frens::f_malloc(poolCapacity);
+        uint32_t *offsets = (uint32_t *)Frens::f_malloc(offsetCapacity * sizeof(uint32_t));
+        uint16_t count = 0;
+        strcpy(names, dirpath);
         while (1)
         {
-
             fr = f_readdir(&dir, &fno);
             if (fr != FR_OK || fno.fname[0] == 0)
                 break; // End or error
             if (fno.fattrib & AM_DIR)
                 continue; // Skip directories
-                          // skip files with wrong extension
             // skip hidden files
             if (fno.fattrib & AM_HID || fno.fname[0] == '.')
                 continue;
@@ -1958,55 +2447,116 @@ uint __not_in_flash_func(storage_get_flash_capacity)()
             if (++iter > MAX_ITER)
             {
                 printf("Error: Too many files in directory, aborting search.\n");
-                f_closedir(&dir);
-                return FR_INT_ERR;
+                fr = FR_INT_ERR;
+                break;
             }
-            // Check file extension
-            int l = strlen(fno.fname);
-            if (l > 4 && strcmp(&fno.fname[l - 4], FILEXTFORSEARCH) == 0)
+            // skip files with wrong extension
+            size_t l = strlen(fno.fname);
+            if (l <= extLen || strcmp(&fno.fname[l - extLen], FILEXTFORSEARCH) != 0)
+                continue;
+            size_t stemLen = l - extLen;
+            if (poolSize + stemLen + 1 > poolCapacity)
             {
-                // Found a file with the correct extension
+                poolCapacity *= 2;
+                names = (char *)Frens::f_realloc(names, poolCapacity);
             }
-            else
+            if (count == offsetCapacity)
             {
-                continue;
+                offsetCapacity *= 2;
+                offsets = (uint32_t *)Frens::f_realloc(offsets, offsetCapacity * sizeof(uint32_t));
             }
-            file_count++;
+            offsets[count++] = (uint32_t)poolSize;
+            memcpy(names + poolSize, fno.fname, stemLen);
+            names[poolSize + stemLen] = '\0';
+            poolSize += stemLen + 1;
+        }
+        f_closedir(&dir);
+        if (fr != FR_OK)
+        {
+            Frens::f_free(names);
+            Frens::f_free(offsets);
+            return fr;
+        }
+        slot.names = names;
+        slot.offsets = offsets;
+        slot.count = count;
+        slot.bytes = poolCapacity + offsetCapacity * sizeof(uint32_t);
+        randomFileCacheBytes += slot.bytes;
+        printf("Cached %d files of %s (%d bytes)\n", count, dirpath, (int)slot.bytes);
+        return FR_OK;
+    }
 
-            // Reservoir sampling: replace current choice with probability 1/file_count
-            if ((rand() % file_count) == 0)
+    // Returns the cache slot for dirpath, building it on first use.
+    static RandomFileDirCache *getRandomFileDirCache(const char *dirpath, FRESULT &fr)
+    {
+        RandomFileDirCache *victim = &randomFileCache[0];
+        fr = FR_OK;
+        for (auto &slot : randomFileCache)
+        {
+            if (slot.names && strcmp(slot.names, dirpath) == 0)
             {
-                const char *name = fno.fname;
-                // Build full path: "<dirpath>/<filename>"
-                size_t dir_len = strlen(dirpath);
-                if (dir_len + 1 + strlen(name) + 1 > out_size)
-                {
-                    // Output buffer too small, skip this file and continue
-                    printf("Output buffer too small for path: %s/%s\n", dirpath, name);
-                    continue;
-                }
-
-                strcpy(out_path, dirpath);
-                if (dirpath[dir_len - 1] != '/' && dirpath[dir_len - 1] != '\\')
+                slot.lastUsed = ++randomFileCacheTick;
+                return &slot;
+            }
+            if (!slot.names || (victim->names && slot.lastUsed < victim->lastUsed))
+            {
+                victim = &slot;
+            }
+        }
+        freeRandomFileDirCache(*victim);
+        fr = buildRandomFileDirCache(dirpath, *victim);
+        if (fr != FR_OK)
+        {
+            return nullptr;
+        }
+        victim->lastUsed = ++randomFileCacheTick;
+        // Drop the least recently used other directories until under the cap
+        while (randomFileCacheBytes > RANDOMFILECACHE_MAX_BYTES)
+        {
+            RandomFileDirCache *oldest = nullptr;
+            for (auto &slot : randomFileCache)
+            {
+                if (slot.names && &slot != victim && (!oldest || slot.lastUsed < oldest->lastUsed))
                 {
-                    strcat(out_path, "/");
+                    oldest = &slot;
                 }
-                strcat(out_path, name);
             }
+            if (!oldest)
+            {
+                break;
+            }
+            freeRandomFileDirCache(*oldest);
         }
-        if (file_count > 0)
+        return victim;
+    }
+
+    FRESULT pick_random_file_fullpath(const char *dirpath, char *out_path, size_t out_size)
+    {
+        FRESULT fr;
+        *out_path = 0;
+
+        RandomFileDirCache *cache = getRandomFileDirCache(dirpath, fr);
+        if (!cache)
         {
-            // strcpy(out_path, "/Metadata/SMS/Images/160/0/00C34D94.444"); // For testing only
-            // strcpy(out_path, "/Metadata/SMS/Images/160/0/0B1BA87F.444"); //
-            printf("Picked random file: %s\n", out_path);
+            return fr;
         }
-        else
+        if (cache->count == 0)
         {
             printf("No files found in directory: %s\n", dirpath);
+            return FR_NO_FILE;
         }
-        f_closedir(&dir);
-
-        return (file_count > 0) ? FR_OK : FR_NO_FILE;
+        const char *name = cache->names + cache->offsets[rand() % cache->count];
+        // Build full path: "<dirpath>/<filename>"
+        size_t dir_len = strlen(dirpath);
+        const char *sep = (dirpath[dir_len - 1] != '/' && dirpath[dir_len - 1] != '\\') ? "/" : "";
+        if ((size_t)snprintf(out_path, out_size, "%s%s%s%s", dirpath, sep, name, FILEXTFORSEARCH) >= out_size)
+        {
+            printf("Output buffer too small for path: %s/%s%s\n", dirpath, name, FILEXTFORSEARCH);
+            *out_path = 0;
+            return FR_INVALID_NAME;
+        }
+        printf("Picked random file: %s\n", out_path);
+        return FR_OK;
     }
 
     /// @brief Load an overlay from file or from memory
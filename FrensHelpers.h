@@ -87,6 +87,10 @@ enum class ScanlineType : uint8_t
 #ifndef F_MALLOC_DEBUG
 #define F_MALLOC_DEBUG 0
 #endif
+// 1: the menu logs its idle share and the idle task stats every ten seconds
+#ifndef MENU_IDLE_DEBUG
+#define MENU_IDLE_DEBUG 0
+#endif
 #ifndef ENABLEDVI
 #define ENABLEDVI 0 
 #endif
@@ -141,6 +145,30 @@ namespace Frens
     // buffer before freeing it.
     typedef void (*LineStreamFillFn)(int line, uint16_t *dst);
     void setLineStreamFill(LineStreamFillFn fn);
+    // Batched variant: core1 asks for lineCount lines at once, dst holds them
+    // back to back (640 pixels each) in a single batch buffer. Fill and TMDS
+    // conversion run back to back on core1, so a batch does not buy the
+    // conversion more time per line; it saves the per-call overhead and lets
+    // the DMA source fetch overlap the conversion. With a prefetch source set, the
+    // source rows of the batch have already been copied to SRAM by DMA while
+    // the previous batch was being converted; prefetched points to them
+    // (rowBytes each, back to back), else it is nullptr.
+    // Takes precedence over setLineStreamFill. Pass nullptr to clear.
+#ifndef LINESTREAM_MAX_BATCH
+#define LINESTREAM_MAX_BATCH 4
+#endif
+    typedef void (*LineStreamBatchFillFn)(int firstLine, int lineCount, uint16_t *dst, const uint8_t *prefetched);
+    void setLineStreamBatchFill(LineStreamBatchFillFn fn, int linesPerBatch = LINESTREAM_MAX_BATCH);
+    // Source rows for the batched fill to prefetch by DMA (e.g. a framebuffer
+    // in PSRAM): row n starts at source + n * rowStride, both word aligned.
+    // Set it while no batch fill is registered. Pass nullptr to stop
+    // prefetching. Returns false when the SRAM buffer cannot be allocated.
+    bool setLineStreamPrefetch(const void *source, uint32_t rowBytes, uint32_t rowStride);
+    // Time core1 spent in the fill callback(s) during the last line-stream
+    // frame, in microseconds. Fill time is taken out of the same core1 budget
+    // as the conversion; comparing the per-line and batched fill shows what
+    // batching and the prefetch save, not any lead of fill over conversion.
+    uint32_t getLineStreamFillUs();
     bool lineStreamActive();
     int initLed();
     void initVintageControllers(uint32_t CPUFreqKHz);
@@ -163,17 +191,76 @@ namespace Frens
     bool isPsramEnabled();
     void *flashromtoPsram(char *selectdRom, bool swapbytes, uint32_t &crc, int crcOffset);
     void PaceFrames60fps(bool init, bool usePicoDVIvsyncWait = false);
-    // Optional task run repeatedly while PaceFrames60fps is waiting out slack
-    // before the next frame (framebuffer DVI path only). Lets the otherwise
+    // Frame rate in Hz as the exact fraction num / den.
+    struct FrameRate
+    {
+        uint32_t num;
+        uint32_t den;
+    };
+    namespace FrameRates
+    {
+        constexpr FrameRate PCE_NTSC = {598261, 10000};             // 59.8261 Hz
+        constexpr FrameRate NES_NTSC = {118125000, 1965513};        // 60.0988 Hz, (236.25 MHz / 11 / 4) / 89341.5 dots
+        constexpr FrameRate NES_PAL = {10640685, 212784};           // 50.0070 Hz, 5320342.5 Hz / (341 * 312) dots
+        constexpr FrameRate SNES_NTSC = NES_NTSC;                   // 60.0988 Hz
+        constexpr FrameRate GAMEBOY = {4194304, 70224};             // 59.7275 Hz
+        constexpr FrameRate SMS_GENESIS_NTSC = {53693175, 896040};  // 59.9227 Hz, 53.693175 MHz / (3420 * 262)
+        constexpr FrameRate SMS_GENESIS_PAL = {53203424, 1070460};  // 49.7015 Hz, 53.203424 MHz / (3420 * 313)
+        constexpr FrameRate PAL_50 = {50, 1};
+        constexpr FrameRate NTSC_60 = {60, 1};
+    }
+    // Sets the rate PaceFrames60fps paces to on the timer path (DVI framebuffer
+    // with USE_PCE_FRAMEBUFFER_PACING) and on HSTX. The frame period is kept as
+    // whole microseconds plus a fractional accumulator, so the long-term rate
+    // is exact. Default FrameRates::PCE_NTSC. The DVI vsync-locked paths keep
+    // following the display.
+    void setFrameRate(FrameRate rate);
+    FrameRate getFrameRate();
+    // 50 Hz display refresh for PAL games. Paced with a ~50 Hz FrameRate every
+    // emulated frame is then shown exactly once, instead of one in five twice.
+    // On HSTX the video mode switches to its 50 Hz variant at runtime; the
+    // PicoDVI timing is fixed once the output runs, so on DVI call this before
+    // initAll.
+    void setDisplayRefresh50Hz(bool enable);
+    bool isDisplayRefresh50Hz();
+    struct FramePaceStats
+    {
+        uint32_t frames;
+        uint32_t overruns;       // frames that started after their deadline; pacing resynced
+        uint32_t droppedFrames;  // display frames skipped by those resyncs (HSTX)
+        uint32_t maxLateUs;      // worst wake-up after a scheduled frame start (timer path)
+        int32_t driftUs;         // wall time minus ideal time since the last resync; 0 when
+                                 // the frame was locked to vsync or the audio clock instead
+        int32_t maxDriftUs;      // largest |driftUs| seen
+    };
+    void getFramePaceStats(FramePaceStats &stats);
+    void resetFramePaceStats();
+    // Optional task run repeatedly while PaceFrames60fps or waitForVSync is
+    // waiting out slack before the next frame. Lets the otherwise
     // idle wait do useful work — e.g. prefetch CD audio sectors from SD — so it
     // overlaps the wait instead of adding to frame time. Pass nullptr to clear.
+    // Registers the task with the idle scheduler (IdleTasks.h) at high priority;
+    // use addIdleTask() directly to run more than one task.
     void setVSyncWaitTask(void (*task)(void));
+    // Frame waits sleep in WFE instead of spinning; core1 raises an
+    // event (SEV) at each frame boundary and interrupts wake core0 as well.
+    // Returns the share of core0 time spent waiting over the last second in
+    // permille (0..1000), not counting time used by the wait task, or -1 when
+    // not yet measured.
+    int getIdlePermille();
     // Audio-clock pacing (framebuffer DVI path). The query returns the active
     // audio output buffer's fill in permille (0..1000); PaceFrames waits until
     // it drains below ~half, locking the frame rate to audio consumption. This
     // is output-agnostic — the caller's query picks HDMI ring vs I2S ring.
     // Pass nullptr to fall back to plain timer pacing.
     void setAudioPaceQuery(int (*query)(void));
+    // Fill of the buffer the default audio output plays from, in permille
+    // (0..1000): on HSTX the buffered HDMI audio against
+    // HSTX_AUDIO_DI_HIGH_WATERMARK unless settings.flags.useExtAudio is set or
+    // headphones are connected, otherwise the I2S ring. -1 when unknown, and
+    // while the buffer has been empty for AUDIO_IDLE_TIMEOUT_US: no audio is
+    // flowing, which is not the same as a producer falling behind.
+    int getAudioOutputFillPermille();
     void toggleScanLines();
     void restoreScanlines();
     void *f_malloc(size_t size);
@@ -191,6 +278,10 @@ namespace Frens
     //extern volatile ProcessScanLineFunction processScanLineFunction;
     void loadOverLay(const char *filename, const char *overlay);
     FRESULT pick_random_file_fullpath(const char *path, char *chosen, size_t bufsize);
+    // pick_random_file_fullpath caches the eligible files per directory on first use,
+    // up to RANDOMFILECACHE_MAX_BYTES in total. Frees that cache, call when the
+    // directories change or the memory is needed (the screensaver does on exit).
+    void freeRandomFileCache();
     uint32_t getCrcOfLoadedRom();
     bool fileExists(const char *filename);
     float read_onboard_temperature(const char unit);
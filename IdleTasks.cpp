@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico.h"
+#include "pico/time.h"
+#include "FrensHelpers.h"
+#include "IdleTasks.h"
+
+namespace Frens
+{
+    struct IdleTask
+    {
+        IdleTaskFn fn;
+        IdleTaskStats stats;
+        uint32_t lastRunSeq; // for round robin among equal priorities
+    };
+
+    static IdleTask idleTasks[MAX_IDLE_TASKS];
+    static uint32_t idleRunSeq = 0;
+    static uint64_t idleTasksTotalUs = 0;
+
+    bool hasIdleTasks()
+    {
+        for (const auto &t : idleTasks)
+        {
+            if (t.fn)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // On HSTX the frame waits live in the driver, hand it the scheduler while tasks exist.
+    static void updateWaitHook()
+    {
+#if HSTX
+        hstx_setWaitHook(hasIdleTasks() ? runIdleTasks : nullptr);
+#endif
+    }
+
+    int addIdleTask(IdleTaskFn fn, IdleTaskPriority priority, uint32_t sliceUs, const char *name)
+    {
+        if (!fn)
+        {
+            return -1;
+        }
+        for (int id = 0; id < MAX_IDLE_TASKS; id++)
+        {
+            IdleTask &t = idleTasks[id];
+            if (!t.fn)
+            {
+                memset(&t, 0, sizeof(t));
+                t.stats.name = name ? name : "idle task";
+                t.stats.priority = priority;
+                t.stats.sliceUs = sliceUs;
+                t.fn = fn;
+                updateWaitHook();
+                return id;
+            }
+        }
+        printf("Error: idle task table full, cannot add %s\n", name ? name : "idle task");
+        return -1;
+    }
+
+    void removeIdleTask(int id)
+    {
+        if (id < 0 || id >= MAX_IDLE_TASKS)
+        {
+            return;
+        }
+        idleTasks[id].fn = nullptr;
+        updateWaitHook();
+    }
+
+    bool __not_in_flash_func(runIdleTasks)(uint32_t deadlineUs)
+    {
+        uint32_t now = time_us_32();
+        int32_t available = (int32_t)(deadlineUs - now) - IDLE_TASK_GUARD_US;
+        if (available <= 0)
+        {
+            return false;
+        }
+        // Highest priority task that fits; equal priorities in least recently run order
+        IdleTask *pick = nullptr;
+        for (auto &t : idleTasks)
+        {
+            if (!t.fn)
+            {
+                continue;
+            }
+            uint32_t slice = t.stats.sliceUs ? t.stats.sliceUs : t.stats.maxUs;
+            if (slice > (uint32_t)available)
+            {
+                continue;
+            }
+            if (!pick || t.stats.priority > pick->stats.priority ||
+                (t.stats.priority == pick->stats.priority && t.lastRunSeq < pick->lastRunSeq))
+            {
+                pick = &t;
+            }
+        }
+        if (!pick)
+        {
+            return false;
+        }
+        IdleTaskFn fn = pick->fn;
+        fn();
+        uint32_t end = time_us_32();
+        uint32_t took = end - now;
+        IdleTaskStats &s = pick->stats;
+        pick->lastRunSeq = ++idleRunSeq;
+        s.runs++;
+        s.totalUs += took;
+        idleTasksTotalUs += took;
+        if (took > s.maxUs)
+        {
+            s.maxUs = took;
+        }
+        if (s.sliceUs && took > s.sliceUs)
+        {
+            s.sliceOverruns++;
+        }
+        if ((int32_t)(end - deadlineUs) > 0)
+        {
+            s.deadlineMisses++;
+        }
+        return true;
+    }
+
+    uint64_t getIdleTasksTotalUs()
+    {
+        return idleTasksTotalUs;
+    }
+
+    bool getIdleTaskStats(int id, IdleTaskStats &stats)
+    {
+        if (id < 0 || id >= MAX_IDLE_TASKS || !idleTasks[id].fn)
+        {
+            return false;
+        }
+        stats = idleTasks[id].stats;
+        return true;
+    }
+
+    void resetIdleTaskStats()
+    {
+        for (auto &t : idleTasks)
+        {
+            IdleTaskStats &s = t.stats;
+            s.runs = 0;
+            s.totalUs = 0;
+            s.maxUs = 0;
+            s.sliceOverruns = 0;
+            s.deadlineMisses = 0;
+        }
+    }
+
+    void printIdleTaskStats()
+    {
+        for (int id = 0; id < MAX_IDLE_TASKS; id++)
+        {
+            const IdleTask &t = idleTasks[id];
+            if (!t.fn)
+            {
+                continue;
+            }
+            const IdleTaskStats &s = t.stats;
+            printf("Idle task %d %s: prio %d, slice %luus, runs %lu, avg %luus, max %luus, overruns %lu, deadline misses %lu\n",
+                   id, s.name, s.priority, (unsigned long)s.sliceUs, (unsigned long)s.runs,
+                   (unsigned long)(s.runs ? s.totalUs / s.runs : 0), (unsigned long)s.maxUs,
+                   (unsigned long)s.sliceOverruns, (unsigned long)s.deadlineMisses);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// Cooperative scheduler for work that runs while core0 waits for the next frame
+// (SD prefetch, wav refill, save flushing, indexing, ...).
+//
+// The frame pacer (PaceFrames60fps / waitForVSync) calls runIdleTasks() with the
+// time the next frame is due. Each call runs at most one task: the highest
+// priority task whose worst-case slice still fits before that deadline, tasks of
+// equal priority taking turns. When nothing fits the pacer sleeps instead.
+// Tasks must return within their slice; run time, slice overruns and deadline
+// misses are tracked per task.
+#ifndef MAX_IDLE_TASKS
+#define MAX_IDLE_TASKS 8
+#endif
+// Margin kept free before the deadline, covers the scheduler and wake-up latency
+#define IDLE_TASK_GUARD_US 50
+
+namespace Frens
+{
+    typedef void (*IdleTaskFn)(void);
+
+    enum IdleTaskPriority : uint8_t
+    {
+        IDLE_PRIORITY_LOW = 0,
+        IDLE_PRIORITY_NORMAL = 1,
+        IDLE_PRIORITY_HIGH = 2,
+    };
+
+    struct IdleTaskStats
+    {
+        const char *name;
+        uint8_t priority;
+        uint32_t sliceUs;        // declared worst case, 0 = use measured worst case
+        uint32_t runs;
+        uint64_t totalUs;
+        uint32_t maxUs;
+        uint32_t sliceOverruns;  // runs that took longer than the declared slice
+        uint32_t deadlineMisses; // runs that finished after the frame deadline
+    };
+
+    // Registers a task. sliceUs is the worst-case run time of one call; pass 0 to
+    // let the scheduler use the longest run measured so far. Returns the task id,
+    // or -1 when the table is full.
+    int addIdleTask(IdleTaskFn fn, IdleTaskPriority priority, uint32_t sliceUs, const char *name);
+    void removeIdleTask(int id);
+    // Runs one task that fits before deadlineUs (time_us_32() time base).
+    // Returns false when no task was run.
+    bool runIdleTasks(uint32_t deadlineUs);
+    bool hasIdleTasks();
+    // Total time spent in idle tasks since boot, in microseconds.
+    uint64_t getIdleTasksTotalUs();
+    // Returns false when id is not a registered task.
+    bool getIdleTaskStats(int id, IdleTaskStats &stats);
+    void resetIdleTaskStats();
+    void printIdleTaskStats();
+}
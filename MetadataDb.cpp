@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico.h"
+#include "ff.h"
+#include "FrensHelpers.h"
+#include "MetadataDb.h"
+
+// Lookup in the packed metadata database, see MetadataDb.h for the file layout.
+namespace MetadataDb
+{
+    struct __attribute__((packed)) Header
+    {
+        char magic[4];
+        uint16_t version;
+        uint16_t fieldCount;
+        uint32_t count;
+        uint32_t indexOffset;
+    };
+
+    struct __attribute__((packed)) IndexEntry
+    {
+        uint32_t crc;
+        uint32_t recordOffset;
+        uint16_t recordSize;
+        uint16_t reserved;
+    };
+
+    static_assert(sizeof(Header) == 16, "Header must be 16 bytes");
+    static_assert(sizeof(IndexEntry) == 12, "IndexEntry must be 12 bytes");
+
+#define FANOUT_ENTRIES 257
+
+    // Cache for the currently opened system. cachedSystem[0] == 0 means nothing cached,
+    // available == false with a cached system means the database is absent or invalid.
+    static char cachedSystem[16];
+    static bool available = false;
+    static Header header;
+    static uint32_t *fanout = nullptr;
+
+    static void buildPath(char *path, size_t size, const char *system)
+    {
+        snprintf(path, size, METADATADB_FILE, system);
+    }
+
+    static bool readAt(FIL *fil, FSIZE_t offset, void *dst, UINT size)
+    {
+        UINT br;
+        if (f_lseek(fil, offset) != FR_OK)
+        {
+            return false;
+        }
+        return f_read(fil, dst, size, &br) == FR_OK && br == size;
+    }
+
+    void close()
+    {
+        if (fanout)
+        {
+            Frens::f_free(fanout);
+            fanout = nullptr;
+        }
+        cachedSystem[0] = '\0';
+        available = false;
+    }
+
+    static bool load(const char *system)
+    {
+        if (cachedSystem[0] && strcmp(cachedSystem, system) == 0)
+        {
+            return available;
+        }
+        close();
+        strncpy(cachedSystem, system, sizeof(cachedSystem) - 1);
+        cachedSystem[sizeof(cachedSystem) - 1] = '\0';
+
+        char path[40];
+        FIL fil;
+        buildPath(path, sizeof(path), system);
+        if (f_open(&fil, path, FA_READ) != FR_OK)
+        {
+            printf("No metadata database %s, using loose files\n", path);
+            return false;
+        }
+        fanout = (uint32_t *)Frens::f_malloc(FANOUT_ENTRIES * sizeof(uint32_t));
+        bool ok = readAt(&fil, 0, &header, sizeof(header)) &&
+                  memcmp(header.magic, METADATADB_MAGIC, sizeof(header.magic)) == 0 &&
+                  header.version == METADATADB_VERSION &&
+                  header.fieldCount >= FIELDCOUNT &&
+                  readAt(&fil, sizeof(header), fanout, FANOUT_ENTRIES * sizeof(uint32_t)) &&
+                  fanout[FANOUT_ENTRIES - 1] == header.count;
+        f_close(&fil);
+        if (!ok)
+        {
+            printf("Invalid metadata database %s, using loose files\n", path);
+            Frens::f_free(fanout);
+            fanout = nullptr;
+            return false;
+        }
+        printf("Metadata database %s: %lu entries\n", path, (unsigned long)header.count);
+        available = true;
+        return true;
+    }
+
+    bool isAvailable(const char *system)
+    {
+        return load(system);
+    }
+
+    char *lookup(const char *system, uint32_t crc)
+    {
+        if (!load(system))
+        {
+            return nullptr;
+        }
+        char path[40];
+        FIL fil;
+        buildPath(path, sizeof(path), system);
+        if (f_open(&fil, path, FA_READ) != FR_OK)
+        {
+            return nullptr;
+        }
+        // Binary search within the bucket of entries sharing the top CRC byte.
+        // Index entries are small, so the probes mostly hit the sector already
+        // buffered in the FIL object.
+        uint32_t lo = fanout[crc >> 24];
+        uint32_t hi = fanout[(crc >> 24) + 1];
+        IndexEntry entry;
+        bool found = false;
+        while (lo < hi)
+        {
+            uint32_t mid = lo + ((hi - lo) >> 1);
+            if (!readAt(&fil, header.indexOffset + (FSIZE_t)mid * sizeof(IndexEntry), &entry, sizeof(entry)))
+            {
+                break;
+            }
+            if (entry.crc == crc)
+            {
+                found = true;
+                break;
+            }
+            if (entry.crc < crc)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        char *record = nullptr;
+        if (found && entry.recordSize > header.fieldCount * sizeof(uint16_t))
+        {
+            record = (char *)Frens::f_malloc(entry.recordSize);
+            if (!readAt(&fil, entry.recordOffset, record, entry.recordSize) || record[entry.recordSize - 1] != '\0')
+            {
+                printf("Error reading metadata record for %08lX\n", (unsigned long)crc);
+                Frens::f_free(record);
+                record = nullptr;
+            }
+            for (int i = 0; record && i < FIELDCOUNT; i++)
+            {
+                if (getField(record, (Field)i) >= record + entry.recordSize)
+                {
+                    Frens::f_free(record);
+                    record = nullptr;
+                }
+            }
+        }
+        f_close(&fil);
+        return record;
+    }
+
+    const char *getField(const char *record, Field field)
+    {
+        uint16_t offset;
+        memcpy(&offset, record + field * sizeof(uint16_t), sizeof(offset));
+        return record + offset;
+    }
+
+    char *copyField(const char *record, Field field, char *buffer, size_t bufsize)
+    {
+        strncpy(buffer, getField(record, field), bufsize - 1);
+        buffer[bufsize - 1] = '\0';
+        return buffer;
+    }
+
+    void freeRecord(char *record)
+    {
+        if (record)
+        {
+            Frens::f_free(record);
+        }
+    }
+} // namespace MetadataDb
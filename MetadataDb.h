@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Packed per-system metadata database.
+//
+// Replaces the loose /metadata/<sys>/descr/<c>/<CRC>.txt files with a single
+// /metadata/<sys>/metadata.db built on the host by tools/build_metadata_db.py.
+// A lookup is one binary search in a sorted CRC index (narrowed by a 256-entry
+// fan-out table on the top CRC byte, cached per system) followed by one small
+// read of the game's record. Records hold a table of field offsets followed by
+// NUL-terminated strings, so fields are used in place without parsing.
+//
+// File layout (little endian):
+//   Header      magic "FMDB", u16 version, u16 fieldCount, u32 count, u32 indexOffset
+//   Fanout      u32[257]  first index entry whose CRC top byte is >= b; [256] = count
+//   Index       count x { u32 crc, u32 recordOffset, u16 recordSize, u16 reserved }, sorted on crc
+//   Records     u16 fieldOffset[fieldCount] (from record start) + NUL-terminated strings
+#define METADATADB_FILE "/metadata/%s/metadata.db"
+#define METADATADB_MAGIC "FMDB"
+#define METADATADB_VERSION 1
+
+namespace MetadataDb
+{
+    enum Field : uint8_t
+    {
+        NAME = 0,
+        RELEASEDATE,
+        DEVELOPER,
+        GENRE,
+        RATING,
+        PLAYERS,
+        DESC,
+        FIELDCOUNT
+    };
+
+    // Returns true when a database is present for the given system. The result
+    // (and the fan-out table) is cached until the system changes or close() is called.
+    bool isAvailable(const char *system);
+    // Looks up a game by CRC. Returns a record buffer allocated with Frens::f_malloc,
+    // to be released with freeRecord(), or nullptr when the database or entry is absent.
+    char *lookup(const char *system, uint32_t crc);
+    // Returns a pointer to the NUL-terminated field inside a record returned by lookup().
+    const char *getField(const char *record, Field field);
+    // Copies a field into buffer, truncated to bufsize - 1 characters.
+    char *copyField(const char *record, Field field, char *buffer, size_t bufsize);
+    void freeRecord(char *record);
+    // Releases the cached fan-out table.
+    void close();
+} // namespace MetadataDb
@@ -0,0 +1,286 @@
+#include <string.h>
+#include <algorithm>
+#include "ScanlineCompositor.h"
+
+namespace Frens
+{
+    static inline bool isEmpty(const ScanlineCompositor::Rect &r)
+    {
+        return r.x0 >= r.x1 || r.y0 >= r.y1;
+    }
+
+    static inline bool coversLine(const ScanlineCompositor::Rect &r, int line)
+    {
+        return !isEmpty(r) && line >= r.y0 && line < r.y1;
+    }
+
+    ScanlineCompositor::ScanlineCompositor(int width_, int height_)
+    {
+        width = width_;
+        height = height_;
+        bgPixels = nullptr;
+        bgColor = 0;
+        textLayer = nullptr;
+        textDirtyY0 = textDirtyY1 = 0;
+        textY0 = textY1 = 0;
+        fullRedraw = true;
+        frameFull = true;
+        memset(sprites, 0, sizeof(sprites));
+    }
+
+    void ScanlineCompositor::setBackground(const uint16_t *pixels, uint16_t color)
+    {
+        bgPixels = pixels;
+        bgColor = color;
+        fullRedraw = true;
+    }
+
+    void ScanlineCompositor::setTextLayer(TextLayerFn fn)
+    {
+        textLayer = fn;
+        fullRedraw = true;
+    }
+
+    void ScanlineCompositor::markTextRows(int y0, int y1)
+    {
+        y0 = std::max(y0, 0);
+        y1 = std::min(y1, height);
+        if (y0 >= y1)
+        {
+            return;
+        }
+        if (textDirtyY0 >= textDirtyY1)
+        {
+            textDirtyY0 = y0;
+            textDirtyY1 = y1;
+        }
+        else
+        {
+            textDirtyY0 = std::min<int>(textDirtyY0, y0);
+            textDirtyY1 = std::max<int>(textDirtyY1, y1);
+        }
+    }
+
+    int ScanlineCompositor::addSprite(const uint16_t *pixels, int w, int h, int x, int y)
+    {
+        for (int id = 0; id < MAX_SPRITES; id++)
+        {
+            Sprite &s = sprites[id];
+            if (!s.used)
+            {
+                // A removed sprite may still have to erase its last position
+                Rect prev = s.prev;
+                memset(&s, 0, sizeof(s));
+                s.prev = prev;
+                s.used = true;
+                s.visible = true;
+                s.clip = {0, 0, (int16_t)width, (int16_t)height};
+                setSpriteImage(id, pixels, w, h);
+                moveSprite(id, x, y);
+                return id;
+            }
+        }
+        return -1;
+    }
+
+    void ScanlineCompositor::removeSprite(int id)
+    {
+        if (!validSprite(id))
+        {
+            return;
+        }
+        // Keep the slot until the next frame has erased its previous position
+        sprites[id].visible = false;
+        sprites[id].dirty = true;
+        sprites[id].used = false;
+    }
+
+    void ScanlineCompositor::setSpriteImage(int id, const uint16_t *pixels, int w, int h)
+    {
+        if (!validSprite(id))
+        {
+            return;
+        }
+        Sprite &s = sprites[id];
+        s.pixels = pixels;
+        s.w = (pixels && w > 0) ? w : 0;
+        s.h = (pixels && h > 0) ? h : 0;
+        s.dirty = true;
+    }
+
+    void ScanlineCompositor::moveSprite(int id, int x, int y)
+    {
+        if (!validSprite(id))
+        {
+            return;
+        }
+        sprites[id].x = x;
+        sprites[id].y = y;
+    }
+
+    void ScanlineCompositor::setSpriteClip(int id, const Rect &clip)
+    {
+        if (!validSprite(id))
+        {
+            return;
+        }
+        sprites[id].clip = clip;
+    }
+
+    void ScanlineCompositor::setSpriteVisible(int id, bool visible)
+    {
+        if (!validSprite(id))
+        {
+            return;
+        }
+        if (sprites[id].visible != visible)
+        {
+            sprites[id].visible = visible;
+            sprites[id].dirty = true;
+        }
+    }
+
+    void ScanlineCompositor::invalidate()
+    {
+        fullRedraw = true;
+    }
+
+    ScanlineCompositor::Rect ScanlineCompositor::visibleRect(const Sprite &s) const
+    {
+        Rect r = {0, 0, 0, 0};
+        if (!s.visible || !s.pixels)
+        {
+            return r;
+        }
+        r.x0 = std::max<int>({s.x, s.clip.x0, 0});
+        r.y0 = std::max<int>({s.y, s.clip.y0, 0});
+        r.x1 = std::min<int>({s.x + s.w, s.clip.x1, width});
+        r.y1 = std::min<int>({s.y + s.h, s.clip.y1, height});
+        return r;
+    }
+
+    void ScanlineCompositor::beginFrame(bool persistentTarget)
+    {
+        frameFull = fullRedraw || !persistentTarget;
+        // The text layer spans the whole line, marked lines are redrawn in full
+        textY0 = textLayer ? textDirtyY0 : 0;
+        textY1 = textLayer ? textDirtyY1 : 0;
+        textDirtyY0 = textDirtyY1 = 0;
+        for (auto &s : sprites)
+        {
+            s.cur = visibleRect(s);
+            s.changed = s.dirty || memcmp(&s.cur, &s.prev, sizeof(Rect)) != 0;
+        }
+    }
+
+    void ScanlineCompositor::endFrame()
+    {
+        for (auto &s : sprites)
+        {
+            s.prev = s.cur;
+            s.dirty = false;
+        }
+        fullRedraw = false;
+    }
+
+    void ScanlineCompositor::fillBackground(int line, uint16_t *dst, int x0, int x1) const
+    {
+        if (x0 >= x1)
+        {
+            return;
+        }
+        if (bgPixels)
+        {
+            memcpy(dst + x0, bgPixels + line * width + x0, (x1 - x0) * sizeof(uint16_t));
+        }
+        else
+        {
+            std::fill(dst + x0, dst + x1, bgColor);
+        }
+    }
+
+    bool ScanlineCompositor::composeLine(int line, uint16_t *dst)
+    {
+        // Span of the line that needs to be rewritten
+        int a = 0, b = width;
+        if (!frameFull && (line < textY0 || line >= textY1))
+        {
+            a = width;
+            b = 0;
+            for (const auto &s : sprites)
+            {
+                if (!s.changed)
+                {
+                    continue;
+                }
+                if (coversLine(s.prev, line))
+                {
+                    a = std::min<int>(a, s.prev.x0);
+                    b = std::max<int>(b, s.prev.x1);
+                }
+                if (coversLine(s.cur, line))
+                {
+                    a = std::min<int>(a, s.cur.x0);
+                    b = std::max<int>(b, s.cur.x1);
+                }
+            }
+            if (a >= b)
+            {
+                return false;
+            }
+        }
+        // Sprite spans on this line within [a, b), sorted on x0
+        int16_t spanX0[MAX_SPRITES], spanX1[MAX_SPRITES];
+        int spanCount = 0;
+        for (const auto &s : sprites)
+        {
+            if (!coversLine(s.cur, line))
+            {
+                continue;
+            }
+            int x0 = std::max<int>(s.cur.x0, a);
+            int x1 = std::min<int>(s.cur.x1, b);
+            if (x0 >= x1)
+            {
+                continue;
+            }
+            int i = spanCount++;
+            while (i > 0 && spanX0[i - 1] > x0)
+            {
+                spanX0[i] = spanX0[i - 1];
+                spanX1[i] = spanX1[i - 1];
+                i--;
+            }
+            spanX0[i] = x0;
+            spanX1[i] = x1;
+        }
+        // Background only in the gaps between sprites
+        int x = a;
+        for (int i = 0; i < spanCount; i++)
+        {
+            fillBackground(line, dst, x, spanX0[i]);
+            x = std::max<int>(x, spanX1[i]);
+        }
+        fillBackground(line, dst, x, b);
+        // Sprites back to front, clipped to [a, b)
+        for (const auto &s : sprites)
+        {
+            if (!coversLine(s.cur, line))
+            {
+                continue;
+            }
+            int x0 = std::max<int>(s.cur.x0, a);
+            int x1 = std::min<int>(s.cur.x1, b);
+            if (x0 < x1)
+            {
+                const uint16_t *src = s.pixels + (line - s.y) * s.w + (x0 - s.x);
+                memcpy(dst + x0, src, (x1 - x0) * sizeof(uint16_t));
+            }
+        }
+        if (textLayer)
+        {
+            textLayer(line, dst);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+
+namespace Frens
+{
+    // Per-scanline layer compositor for the menu.
+    //
+    // Layers, back to front: a background (solid color or a full-screen image such
+    // as an overlay/border), up to MAX_SPRITES opaque sprites with position and clip
+    // rectangle, and an optional text layer drawn over the whole line.
+    //
+    // Lines are composited span by span: the background is only written in the gaps
+    // between sprites, and sprites are copied clipped to the span being redrawn.
+    // When the target keeps its contents between frames (a framebuffer), only the
+    // spans covered by sprites that moved or changed, before and after the change,
+    // and the lines whose text was marked with markTextRows() are rewritten;
+    // composeLine() returns false for lines that need no update.
+    // Line buffer targets (DVI without framebuffer) are always composed in full.
+    class ScanlineCompositor
+    {
+    public:
+        static constexpr int MAX_SPRITES = 8;
+        // Draws the text layer of a line over dst.
+        typedef void (*TextLayerFn)(int line, uint16_t *dst);
+        // Half-open rectangle in screen coordinates.
+        struct Rect
+        {
+            int16_t x0, y0, x1, y1;
+        };
+
+        ScanlineCompositor(int width, int height);
+
+        // pixels: full-screen image (width x height) or nullptr to use color.
+        void setBackground(const uint16_t *pixels, uint16_t color);
+        void setTextLayer(TextLayerFn fn);
+        // Marks lines [y0, y1) of the text layer as changed, so they are
+        // rewritten in full on the next frame.
+        void markTextRows(int y0, int y1);
+        // Returns the sprite id, or -1 when all sprite slots are in use.
+        int addSprite(const uint16_t *pixels, int w, int h, int x = 0, int y = 0);
+        void removeSprite(int id);
+        void setSpriteImage(int id, const uint16_t *pixels, int w, int h);
+        void moveSprite(int id, int x, int y);
+        void setSpriteClip(int id, const Rect &clip);
+        void setSpriteVisible(int id, bool visible);
+        // Forces a full repaint on the next frame, e.g. after the target was cleared.
+        void invalidate();
+
+        // Call once per frame before composing its lines. persistentTarget tells
+        // whether the destination lines still hold the previous frame.
+        void beginFrame(bool persistentTarget);
+        bool composeLine(int line, uint16_t *dst);
+        void endFrame();
+
+    private:
+        struct Sprite
+        {
+            const uint16_t *pixels;
+            int16_t w, h, x, y;
+            Rect clip;
+            Rect cur;  // visible rectangle this frame
+            Rect prev; // visible rectangle last frame
+            bool used;
+            bool visible;
+            bool dirty;   // image or visibility changed since last frame
+            bool changed; // needs redraw this frame
+        };
+        // Only slots in use; a removed slot is kept until its last position is erased
+        bool validSprite(int id) const
+        {
+            return id >= 0 && id < MAX_SPRITES && sprites[id].used;
+        }
+        Rect visibleRect(const Sprite &s) const;
+        void fillBackground(int line, uint16_t *dst, int x0, int x1) const;
+
+        int width;
+        int height;
+        const uint16_t *bgPixels;
+        uint16_t bgColor;
+        TextLayerFn textLayer;
+        int16_t textDirtyY0, textDirtyY1; // marked since the last beginFrame
+        int16_t textY0, textY1;           // redrawn this frame
+        bool fullRedraw;
+        bool frameFull;
+        Sprite sprites[MAX_SPRITES];
+    };
+}
@@ -1,22 +1,78 @@
 #if PICO_RP2350
 #include "hstx.h"
+#include "hstx_scaler.h"
 #include "pico/multicore.h" 
+#include "hardware/sync.h"
+#include "hardware/dma.h"
+#include "hardware/timer.h"
 #include "stdio.h"
+#include "string.h"
+#include "stdlib.h"
 // Custom changes
 volatile bool HSTX_vblank = false;
-static uint8_t FRAMEBUFFER[(MODE_H_ACTIVE_PIXELS / 2) * (MODE_V_ACTIVE_LINES / 2) * 2] __attribute__((aligned(4)));
-// uint16_t ALIGNED HDMIlines[2][MODE_H_ACTIVE_PIXELS] = {0};
-static uint8_t *WriteBuf = FRAMEBUFFER;
-static uint8_t *DisplayBuf = FRAMEBUFFER;
-static uint8_t *LayerBuf = FRAMEBUFFER;
+#if HSTX_FRAMEBUFFER_PSRAM
+// Set by hstx_setFramebufferMemory(), or allocated from the heap by hstx_init()
+static uint8_t *FRAMEBUFFER = NULL;
+#define FRAMEBUFFER_INITIAL NULL
+#else
+static uint8_t FRAMEBUFFER_SRAM[HSTX_FRAMEBUFFER_BYTES] __attribute__((aligned(4)));
+static uint8_t *FRAMEBUFFER = FRAMEBUFFER_SRAM;
+#define FRAMEBUFFER_INITIAL FRAMEBUFFER_SRAM
+#endif
+static uint8_t *WriteBuf = FRAMEBUFFER_INITIAL;
+static uint8_t *volatile DisplayBuf = FRAMEBUFFER_INITIAL;
+static uint8_t *LayerBuf = FRAMEBUFFER_INITIAL;
 static uint16_t *tilefcols;
 static uint16_t *tilebcols;
 static volatile int enableScanLines = 0;
 static volatile int enableAspectRatio87 = 0;
 static volatile int scanlineType = 0;
 static volatile int scanlineMode = 0;
-#define HRes (MODE_H_ACTIVE_PIXELS / 2) // 320
-#define VRes (MODE_V_ACTIVE_LINES / 2)  // 240
+#define HRes (HSTX_LINE_PIXELS / 2) // 320
+#define VRes 240
+// Framebuffer pixel format. HSTX_FB_INDEXED8 uses only the first HRes * VRes
+// bytes of FRAMEBUFFER and expands through palette[] during scanout;
+// palette_dark[] holds the same colours at half brightness for scanlines.
+static volatile hstx_fb_format_t fb_format = HSTX_FB_RGB555;
+static uint16_t palette[256];
+static uint16_t palette_dark[256];
+// Last expanded row. Each framebuffer row is output twice, and the odd output
+// line equals the even one, darkened as a whole when scanlines are on (also
+// for the LCD type). The even line's buffer is left alone while the odd line
+// is filled (video_output double-buffers the lines), so it serves as cache.
+static const uint32_t *cached_line = NULL;
+static int cached_row = -1;
+static bool (*volatile wait_hook)(uint32_t deadline_us) = NULL;
+// time_us_32() of the last vsync and the measured frame period, used to tell
+// the wait hook when the frame it is waiting for will start.
+static volatile uint32_t last_vsync_us = 0;
+static volatile uint32_t frame_period_us = 16667;
+
+void hstx_setWaitHook(bool (*hook)(uint32_t deadline_us))
+{
+    wait_hook = hook;
+}
+
+// One iteration of a loop waiting for video_frame_count to reach target_frame:
+// offer the time up to the estimated start of that frame to the wait hook, and
+// sleep until the next event when the hook has nothing to run.
+// hstx_vsync_callbackfunc() raises an event with __sev() right after
+// video_frame_count advances, so WFE cannot miss a frame.
+static inline void wait_for_event(uint32_t target_frame)
+{
+    bool (*hook)(uint32_t) = wait_hook;
+    if (hook)
+    {
+        int32_t frames = (int32_t)(target_frame - video_frame_count);
+        uint32_t deadline = last_vsync_us + (frames > 0 ? (uint32_t)frames : 1u) * frame_period_us;
+        if (hook(deadline))
+        {
+            return;
+        }
+    }
+    __wfe();
+}
+
 void hstx_waitForVSync(void)
 {
     // Wait until the frame counter advances, indicating a new vsync edge.
@@ -26,32 +82,56 @@ void hstx_waitForVSync(void)
     uint32_t current = video_frame_count;
     while (video_frame_count == current)
     {
-        tight_loop_contents();
+        wait_for_event(current + 1);
     }
 }
 
-void hstx_paceFrame(bool init)
+// Emulated frame rate in Hz as num / den, PCE NTSC (59.8261 Hz) by default.
+static uint32_t pace_rate_num = 598261u;
+static uint32_t pace_rate_den = 10000u;
+static bool pace_rate_changed = false;
+
+void hstx_setFrameRate(uint32_t num, uint32_t den)
+{
+    if (num == 0 || den == 0)
+    {
+        return;
+    }
+    pace_rate_num = num;
+    pace_rate_den = den;
+    pace_rate_changed = true;
+}
+
+int hstx_paceFrame(bool init)
 {
-    // Slack-aware pacing to true PCE NTSC rate (59.8261 Hz), not the HDMI
-    // signal's 60 Hz. video_frame_count ticks at 60 Hz, so on average we wait
-    // 60/59.8261 ≈ 1.00291 vsyncs per emulator frame: most calls advance by 1,
-    // and roughly once every 344 frames (~5.7s) we advance by 2 — invisible to
-    // the eye but it brings game-side per-vsync logic (music tempo, bullet
-    // velocity) into agreement with native PCE timing.
+    // Slack-aware pacing to the emulated system's exact frame rate (set with
+    // hstx_setFrameRate, PCE NTSC 59.8261 Hz by default), not the HDMI
+    // signal's refresh rate. video_frame_count ticks at the display rate
+    // MODE_PIXEL_CLOCK_HZ / (h_total * v_total), so on average we wait
+    // display_rate / frame_rate vsyncs per emulator frame: for PCE on 60 Hz
+    // most calls advance by 1, and roughly once every 344 frames (~5.7s) we
+    // advance by 2 — invisible to the eye but it brings game-side per-vsync
+    // logic (music tempo, bullet velocity) into agreement with native timing.
+    // The ratio is kept as an exact fraction, so there is no long-term drift.
     //
     // If the caller overran a frame, resync to the current counter instead of
     // stalling, which would otherwise harmonic-lock the loop to 30fps.
     static uint32_t target_frame = 0;
-    static uint32_t pace_accum = 0;   // scaled by 10000
-    if (init)
+    // accum / (frame_total * num) is the fractional vsync count carried over.
+    static uint64_t pace_accum = 0;
+    const video_timing_t *timing = video_output_get_timing();
+    const uint64_t frame_total = (uint64_t)VIDEO_TIMING_H_TOTAL(timing) * VIDEO_TIMING_V_TOTAL(timing);
+    if (init || pace_rate_changed)
     {
         target_frame = video_frame_count;
         pace_accum = 0;
+        pace_rate_changed = false;
     }
-    // accum += 60.0 / 59.8261, both scaled by 10000.
-    pace_accum += 600000u;
-    uint32_t step = pace_accum / 598261u;   // 1 or 2
-    pace_accum -= step * 598261u;
+    // accum += display_rate / frame_rate, scaled by frame_total * num.
+    uint64_t one_frame = frame_total * pace_rate_num;
+    pace_accum += (uint64_t)MODE_PIXEL_CLOCK_HZ * pace_rate_den;
+    uint32_t step = (uint32_t)(pace_accum / one_frame);
+    pace_accum -= step * one_frame;
     target_frame += step;
     int32_t lag = (int32_t)(video_frame_count - target_frame);
     if (lag < 0)
@@ -61,13 +141,14 @@ void hstx_paceFrame(bool init)
         // checks (a != loop would spin until wrap).
         while ((int32_t)(video_frame_count - target_frame) < 0)
         {
-            tight_loop_contents();
+            wait_for_event(target_frame);
         }
     }
     else if (lag > 0)
     {
         // More than one full frame behind: drop the missed frames.
         target_frame = video_frame_count;
+        return lag;
     }
     // lag == 0 — a vsync tick landed inside this frame's execution. Do NOT
     // resync: that forgets the tick phase, and in heavy scenes (frame time
@@ -77,6 +158,7 @@ void hstx_paceFrame(bool init)
     // alone means this frame consumed exactly its one tick and the next call
     // waits as usual — overspeed is impossible, and a genuinely slow frame
     // still passes through without stalling (no 30fps harmonic lock).
+    return 0;
 }
 uint8_t *hstx_getframebuffer(void)
 {
@@ -84,46 +166,163 @@ uint8_t *hstx_getframebuffer(void)
     return WriteBuf;
 }
 
-void hstx_setScanLines(int enable)
+static void prefetch_enable(const uint8_t *buffer);
+
+// Swap chain. sc_front is scanned out, sc_pending waits for the next vsync
+// and sc_back is being rendered (-1 when none). Any other buffer is free.
+// The state is shared between core0 (acquire/present) and the vsync callback
+// on core1, hence the spin lock.
+static uint8_t *sc_buffers[HSTX_SWAPCHAIN_MAX_BUFFERS];
+static int sc_count = 0; // 0: single buffered
+static bool sc_paused = false;
+static int sc_front = 0;
+static int sc_pending = -1;
+static int sc_back = -1;
+static uint32_t sc_present_us;
+static uint64_t sc_latency_total_us;
+static hstx_swapchain_stats_t sc_stats;
+static spin_lock_t *sc_lock = NULL;
+
+bool hstx_swapchainInit(uint8_t *const buffers[], int count)
 {
-    // Set the scanlines effect flag
-    enableScanLines = enable ? 1 : 0;
+    if (count < 1 || count > HSTX_SWAPCHAIN_MAX_BUFFERS)
+        return false;
+    int builtin = 0;
+    for (int i = 0; i < count; i++)
+        builtin += !buffers || !buffers[i];
+    if (builtin > 1)
+        return false;
+    if (!sc_lock)
+        sc_lock = spin_lock_instance(spin_lock_claim_unused(true));
+    uint32_t save = spin_lock_blocking(sc_lock);
+    sc_count = count > 1 ? count : 0;
+    for (int i = 0; i < count; i++)
+    {
+        sc_buffers[i] = buffers && buffers[i] ? buffers[i] : FRAMEBUFFER;
+        prefetch_enable(sc_buffers[i]);
+    }
+    sc_paused = false;
+    sc_front = 0;
+    sc_pending = -1;
+    sc_back = -1;
+    sc_latency_total_us = 0;
+    memset(&sc_stats, 0, sizeof(sc_stats));
+    WriteBuf = DisplayBuf = sc_count ? sc_buffers[0] : FRAMEBUFFER;
+    spin_unlock(sc_lock, save);
+    return true;
 }
 
-void hstx_setAspectRatio87(int enable)
+void hstx_setSwapchainPaused(bool paused)
 {
-    enableAspectRatio87 = enable ? 1 : 0;
+    if (!sc_count || paused == sc_paused)
+        return;
+    uint32_t save = spin_lock_blocking(sc_lock);
+    sc_paused = paused;
+    sc_pending = -1;
+    sc_back = -1;
+    WriteBuf = DisplayBuf = paused ? FRAMEBUFFER : sc_buffers[sc_front];
+    spin_unlock(sc_lock, save);
 }
 
-void hstx_setScanLineType(int type)
+uint8_t *hstx_acquireBackBuffer(void)
 {
-    scanlineType = type;
+    if (!sc_count || sc_paused)
+        return WriteBuf;
+    for (;;)
+    {
+        uint32_t save = spin_lock_blocking(sc_lock);
+        for (int i = 0; sc_back < 0 && i < sc_count; i++)
+        {
+            if (i != sc_front && i != sc_pending)
+                sc_back = i;
+        }
+        int back = sc_back;
+        spin_unlock(sc_lock, save);
+        if (back >= 0)
+        {
+            WriteBuf = sc_buffers[back];
+            return WriteBuf;
+        }
+        // Double buffered with a frame still pending: it flips at the next vsync
+        uint32_t frame = video_frame_count;
+        while (video_frame_count == frame)
+            wait_for_event(frame + 1);
+    }
 }
 
-uint16_t *__not_in_flash_func(hstx_getlineFromFramebuffer)(int scanline)
+void hstx_present(void)
 {
-    return (uint16_t *)(WriteBuf + (scanline * HRes * 2));
+    if (!sc_count || sc_paused || sc_back < 0)
+        return;
+    uint32_t save = spin_lock_blocking(sc_lock);
+    if (sc_pending >= 0)
+        sc_stats.dropped++; // triple buffering: the newer frame replaces it
+    sc_pending = sc_back;
+    sc_back = -1;
+    sc_present_us = time_us_32();
+    sc_stats.presented++;
+    spin_unlock(sc_lock, save);
 }
-void __not_in_flash_func(hstx_vsync_callbackfunc)(void)
+
+// Called from the vsync callback, before the first line of the next frame
+static inline void swapchain_flip(uint32_t now)
 {
-   HSTX_vblank = true;
+    if (!sc_count)
+        return;
+    spin_lock_unsafe_blocking(sc_lock);
+    if (!sc_paused)
+    {
+        if (sc_pending >= 0)
+        {
+            sc_front = sc_pending;
+            sc_pending = -1;
+            DisplayBuf = sc_buffers[sc_front];
+            uint32_t latency = now - sc_present_us;
+            sc_latency_total_us += latency;
+            if (latency > sc_stats.latency_max_us)
+                sc_stats.latency_max_us = latency;
+            sc_stats.flipped++;
+        }
+        else if (sc_stats.flipped)
+        {
+            sc_stats.duplicated++;
+        }
+    }
+    spin_unlock_unsafe(sc_lock);
+}
+
+void hstx_getSwapchainStats(hstx_swapchain_stats_t *stats)
+{
+    if (!sc_lock)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    uint32_t save = spin_lock_blocking(sc_lock);
+    *stats = sc_stats;
+    stats->latency_avg_us = sc_stats.flipped ? (uint32_t)(sc_latency_total_us / sc_stats.flipped) : 0;
+    spin_unlock(sc_lock, save);
 }
 
 /// Per-scanline callback invoked by the HSTX video output on core 1.
-/// Converts one row of the 320x240 RGB555 framebuffer into a 640-pixel
-/// output scanline in `buff`, applying vertical line-doubling, optional
-/// scanline darkening, and either 1:1 or 8:7 horizontal scaling.
+/// Converts one row of the 320x240 framebuffer into a 640-pixel output
+/// scanline in `buff`, applying vertical line-doubling, optional scanline
+/// darkening, and either 1:1 or 8:7 horizontal scaling.
 ///
-/// Framebuffer layout : 320 x 240 pixels, 16 bpp (RGB555), row stride =
-///                      MODE_H_ACTIVE_PIXELS bytes (640).
+/// Framebuffer layout : 320 x 240 pixels, either 16 bpp RGB555 (row stride
+///                      640 bytes) or 8 bpp palette indices (HSTX_FB_INDEXED8,
+///                      row stride 320 bytes, expanded through palette[]).
 /// Output             : 640 x 480, each framebuffer row used twice
-///                      (load_line >> 1 maps two output lines to one row).
+///                      (active_line >> 1 maps two output lines to one row).
+///                      In the 1280x240 mode each row is used once and the
+///                      640-pixel line is widened to 1280 (widen_line).
 ///
 /// Darkening math     : halve every RGB555 channel in one step by masking
 ///                      out the per-channel LSB and shifting right:
 ///                        dark(px) = (px & 0x7BDE) >> 1
 ///                      For a pair of pixels packed in a uint32_t:
 ///                        dark(pair) = (pair & 0x7BDE7BDE) >> 1
+///                      Indexed pixels use palette_dark[] instead.
 ///
 /// Scanline effects (active only when enableScanLines != 0):
 ///   stype 0 (Simple) : darken the entire odd output line by 50 %.
@@ -154,156 +353,483 @@ void __not_in_flash_func(hstx_vsync_callbackfunc)(void)
 ///
 ///   This repeats 36 times (36 x 7 = 252 src, 36 x 16 = 576 dst).
 ///
+///   The kernels come from HSTX_SCALER_PHASED() in hstx_scaler.h, with the
+///   sampling phase chosen to give exactly this pattern. An emulator with a
+///   different ratio or crop replaces it with hstx_setAspectScaler().
+///
 /// -- 1:1 pixel doubling --
 ///   Each source pixel is written twice (low and high half of a uint32_t).
-///   320 source pixels -> 640 output pixels, 160 loop iterations (reading
-///   two source pixels per uint32_t).
+///   320 source pixels -> 640 output pixels.
+///
+/// Every combination of pixel format, scaler, LCD column effect and darkened
+/// line is a separate kernel; select_kernels() picks the ones for the current
+/// settings whenever they change, so the per-line path has no mode branches.
+/// Odd output lines reuse the even line (see cached_line) and only run a
+/// kernel when that line is not available.
+
+HSTX_SCALER_PHASED(scaler_87, 34, 7, 16, 36, 8);
+
+// Two output pixels in one word, the high one darkened for the LCD type
+static inline __attribute__((always_inline)) uint32_t out_pair(uint32_t lo, uint32_t hi, const int lcd)
+{
+    return lo | ((lcd ? (hi & 0x7BDEu) >> 1 : hi) << 16);
+}
+
+// The 1:1 kernel template; the mode arguments are compile-time constants in
+// every instantiation below.
+static inline __attribute__((always_inline)) void expand_row(const uint8_t *row, uint32_t *buff, const uint16_t *pal,
+                                                              const int indexed, const int lcd, const int dark)
+{
+    uint32_t *dp = buff;
+    if (indexed) {
+        // Four source pixels per word read
+        const uint32_t *src = (const uint32_t *)row;
+        for (int i = 0; i < HRes / 4; i++) {
+            uint32_t quad = src[i];
+            uint32_t px0 = pal[quad & 0xFFu], px1 = pal[(quad >> 8) & 0xFFu];
+            uint32_t px2 = pal[(quad >> 16) & 0xFFu], px3 = pal[quad >> 24];
+            *dp++ = out_pair(px0, px0, lcd);
+            *dp++ = out_pair(px1, px1, lcd);
+            *dp++ = out_pair(px2, px2, lcd);
+            *dp++ = out_pair(px3, px3, lcd);
+        }
+    } else {
+        // Two source pixels per word read
+        const uint32_t *src = (const uint32_t *)row;
+        for (int i = 0; i < HRes / 2; i++) {
+            uint32_t pair = src[i];
+            if (dark)
+                pair = (pair & 0x7BDE7BDEu) >> 1;
+            uint32_t px0 = pair & 0xFFFFu;
+            uint32_t px1 = pair >> 16;
+            *dp++ = out_pair(px0, px0, lcd);
+            *dp++ = out_pair(px1, px1, lcd);
+        }
+    }
+}
+
+#define ROW_KERNEL(indexed, lcd, dark)                                                               \
+    static void __not_in_flash_func(scaler_11_##indexed##lcd##dark)(const uint8_t *row, uint32_t *buff, \
+                                                                     const uint16_t *pal)              \
+    {                                                                                                \
+        expand_row(row, buff, pal, indexed, lcd, dark);                                              \
+    }
+ROW_KERNEL(0, 0, 0) ROW_KERNEL(0, 0, 1) ROW_KERNEL(0, 1, 0) ROW_KERNEL(0, 1, 1)
+ROW_KERNEL(1, 0, 0) ROW_KERNEL(1, 0, 1) ROW_KERNEL(1, 1, 0) ROW_KERNEL(1, 1, 1)
+#undef ROW_KERNEL
+
+static const hstx_scaler_t scaler_11 = {{{{scaler_11_000, scaler_11_001}, {scaler_11_010, scaler_11_011}},
+                                         {{scaler_11_100, scaler_11_101}, {scaler_11_110, scaler_11_111}}}};
+
+// Odd line from the cached even line
+static void __not_in_flash_func(copy_line)(const uint32_t *src, uint32_t *buff)
+{
+    // Volatile stores: keep GCC from calling flash-resident memcpy
+    volatile uint32_t *vp = buff;
+    for (int i = 0; i < HSTX_LINE_PIXELS / 2; i++)
+        vp[i] = src[i];
+}
+
+static void __not_in_flash_func(darken_line)(const uint32_t *src, uint32_t *buff)
+{
+    for (int i = 0; i < HSTX_LINE_PIXELS / 2; i++)
+        buff[i] = (src[i] & 0x7BDE7BDEu) >> 1;
+}
+
+// Active kernels, set by select_kernels()
+static const hstx_scaler_t *volatile aspect_scaler = &scaler_87;
+static hstx_row_kernel_t volatile kernel_even = scaler_11_000;
+static hstx_row_kernel_t volatile kernel_odd = scaler_11_000;
+static const uint16_t *volatile palette_odd = palette;
+static void (*volatile odd_from_even)(const uint32_t *src, uint32_t *buff) = copy_line;
+static volatile uint32_t row_bytes = HRes * 2;
+
+static void select_kernels(void)
+{
+    const hstx_scaler_t *scaler = enableAspectRatio87 ? aspect_scaler : &scaler_11;
+    int indexed = fb_format == HSTX_FB_INDEXED8;
+    int lcd = enableScanLines && scanlineType == 1;
+    kernel_even = scaler->kernels[indexed][lcd][0];
+    kernel_odd = scaler->kernels[indexed][lcd][enableScanLines];
+    palette_odd = enableScanLines ? palette_dark : palette;
+    odd_from_even = enableScanLines ? darken_line : copy_line;
+    row_bytes = indexed ? HRes : HRes * 2;
+    cached_row = -1; // the cached even line was expanded with the old settings
+}
+
+void hstx_setAspectScaler(const hstx_scaler_t *scaler)
+{
+    aspect_scaler = scaler ? scaler : &scaler_87;
+    select_kernels();
+}
+
+#if HSTX_FRAMEBUFFER_PSRAM
+// Row prefetch for a displayed buffer outside SRAM (PSRAM). Reading it from
+// the scanline IRQ would stall on every QMI access, so a DMA channel copies
+// rows into prefetch_ring up to HSTX_PREFETCH_ROWS - 1 rows ahead and the
+// kernels read the ring. Transfers complete in order, one at a time: when
+// the channel is idle every issued row has landed. Slots are row_bytes apart,
+// so consecutive rows are consecutive in the ring as in the framebuffer.
+static uint8_t prefetch_ring[HSTX_PREFETCH_ROWS * HRes * 2] __attribute__((aligned(4)));
+static int prefetch_chan = -1;
+static const uint8_t *prefetch_src = NULL; // NULL: read DisplayBuf directly
+static int prefetch_issued = -1;           // last row transferred or in flight
+static int prefetch_done = -1;             // last row known to be in the ring
+static uint32_t prefetch_rows_bytes;       // row_bytes for this frame
+static volatile uint32_t prefetch_stalls = 0;
+
+static inline bool in_sram(const void *p)
+{
+    return (uintptr_t)p >= SRAM_BASE && (uintptr_t)p < SRAM_END;
+}
+
+static void prefetch_enable(const uint8_t *buffer)
+{
+    if (prefetch_chan >= 0 || !buffer || in_sram(buffer))
+        return;
+    prefetch_chan = dma_claim_unused_channel(false);
+    if (prefetch_chan < 0)
+    {
+        printf("HSTX: no DMA channel for row prefetch, reading PSRAM directly\n");
+        return;
+    }
+    dma_channel_config c = dma_channel_get_default_config(prefetch_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(prefetch_chan, &c, prefetch_ring, NULL, 0, false);
+}
+
+static inline void prefetch_issue(int row, int rows)
+{
+    dma_channel_set_write_addr(prefetch_chan, prefetch_ring + (row % HSTX_PREFETCH_ROWS) * prefetch_rows_bytes, false);
+    dma_channel_set_read_addr(prefetch_chan, prefetch_src + row * prefetch_rows_bytes, false);
+    dma_channel_set_trans_count(prefetch_chan, rows * prefetch_rows_bytes / 4, true);
+    prefetch_issued = row + rows - 1;
+}
+
+// At vsync: rows 0 .. HSTX_PREFETCH_ROWS - 2 in one transfer, which has the
+// whole vertical blanking to complete.
+static inline void prefetch_frame_start(void)
+{
+    const uint8_t *src = DisplayBuf;
+    prefetch_src = prefetch_chan >= 0 && !in_sram(src) ? src : NULL;
+    if (!prefetch_src)
+        return;
+    dma_channel_abort(prefetch_chan);
+    prefetch_rows_bytes = row_bytes;
+    prefetch_done = -1;
+    prefetch_issued = -1;
+    prefetch_issue(0, HSTX_PREFETCH_ROWS - 1);
+}
+
+// Issues the next row when the channel is idle. Rows up to row + ring - 1
+// may be fetched: that slot last held row - 1, whose lines are done.
+static inline void prefetch_pump(int row)
+{
+    if (dma_channel_is_busy(prefetch_chan))
+        return;
+    prefetch_done = prefetch_issued;
+    int next = prefetch_issued + 1;
+    if (next < VRes && next <= row + HSTX_PREFETCH_ROWS - 1)
+        prefetch_issue(next, 1);
+}
+
+static inline const uint8_t *prefetch_row(int row)
+{
+    prefetch_pump(row);
+    if (prefetch_done < row)
+    {
+        // Behind: the QMI was too busy. Only waits for the DMA, never for the
+        // QMI from this core.
+        prefetch_stalls++;
+        while (prefetch_done < row)
+            prefetch_pump(row);
+    }
+    return prefetch_ring + (row % HSTX_PREFETCH_ROWS) * prefetch_rows_bytes;
+}
+
+// Also read by the line monitor in the DMA IRQ
+uint32_t __not_in_flash_func(hstx_getPrefetchStalls)(void)
+{
+    return prefetch_stalls;
+}
+#else
+// Framebuffers live in SRAM: no ring, the kernels always read DisplayBuf
+static const uint8_t *const prefetch_src = NULL;
+
+static void prefetch_enable(const uint8_t *buffer)
+{
+    (void)buffer;
+}
+
+static inline void prefetch_frame_start(void)
+{
+}
+
+static inline void prefetch_pump(int row)
+{
+    (void)row;
+}
+
+static inline const uint8_t *prefetch_row(int row)
+{
+    return &DisplayBuf[row * row_bytes];
+}
+
+uint32_t __not_in_flash_func(hstx_getPrefetchStalls)(void)
+{
+    return 0;
+}
+#endif
+
+void hstx_setFramebufferMemory(uint8_t *buffer)
+{
+    if (!buffer)
+        return;
+    if (DisplayBuf == FRAMEBUFFER)
+        DisplayBuf = buffer;
+    if (WriteBuf == FRAMEBUFFER)
+        WriteBuf = buffer;
+    FRAMEBUFFER = buffer;
+    prefetch_enable(buffer);
+}
+
+// 1280x240: the row kernel writes the 640-pixel line into the upper half of
+// the buffer, which is then widened in place to 1280 pixels from the front
+// (word i of the half is read before output words 2i, 2i + 1 reach it).
+static void __not_in_flash_func(widen_line)(uint32_t *buff)
+{
+    const uint32_t *src = buff + HSTX_LINE_PIXELS / 2;
+    for (int i = 0; i < HSTX_LINE_PIXELS / 2; i++) {
+        uint32_t pair = src[i];
+        uint32_t lo = pair & 0xFFFFu, hi = pair >> 16;
+        buff[2 * i] = lo | (lo << 16);
+        buff[2 * i + 1] = hi | (hi << 16);
+    }
+}
+
 void __not_in_flash_func(scanline_callbackfunc)(uint32_t v_scanline, uint32_t active_line, uint32_t *buff)
 {
-    int load_line = v_scanline - (MODE_V_TOTAL_LINES - MODE_V_ACTIVE_LINES);
-    if (load_line < 0 || load_line >= MODE_V_ACTIVE_LINES)
+    (void)v_scanline;
+    const video_timing_t *timing = video_output_get_timing();
+    if (active_line >= timing->v_active_lines)
         return;
 
     HSTX_vblank = false;
     __dmb();
 
-    int Line_dup = load_line >> 1;
-    const uint32_t DARKEN_MASK = 0x7BDE7BDEu;
-    const uint16_t DM = 0x7BDEu;
-    int is_odd_line = load_line & 1;
-    int do_scanline = is_odd_line && enableScanLines;
-    int stype = enableScanLines ? scanlineType : 0;
-
-    if (enableAspectRatio87) {
-        const uint16_t *sp = (const uint16_t *)&DisplayBuf[Line_dup * MODE_H_ACTIVE_PIXELS] + 34;
-        uint32_t *dp = buff;
-
-        // 32 px left black border (16 uint32_t words). Volatile stores so GCC
-        // cannot replace the loop with a call to flash-resident memset: this
-        // runs in the scanline DMA IRQ, and a flash fetch here can stall
-        // behind QMI traffic (e.g. a CHD hunk decompress hammering PSRAM),
-        // blowing the line-fill deadline and scanning out a corrupt line.
-        volatile uint32_t *bp = dp;
-        for (int i = 0; i < 16; i++)
-            bp[i] = 0;
-        dp += 16;
-
-        if (stype == 1) {
-            for (int g = 0; g < 36; g++) {
-                uint32_t p0=*sp++,p1=*sp++,p2=*sp++,p3=*sp++,p4=*sp++,p5=*sp++,p6=*sp++;
-                if (do_scanline) {
-                    p0=(p0&DM)>>1; p1=(p1&DM)>>1; p2=(p2&DM)>>1; p3=(p3&DM)>>1;
-                    p4=(p4&DM)>>1; p5=(p5&DM)>>1; p6=(p6&DM)>>1;
-                }
-                uint32_t d0=(p0&DM)>>1,d1=(p1&DM)>>1,d2=(p2&DM)>>1,d3=(p3&DM)>>1;
-                uint32_t d4=(p4&DM)>>1,d5=(p5&DM)>>1,d6=(p6&DM)>>1;
-                // [2,2,2,3,2,2,3] pattern: normal pixel in low half, darkened in high half
-                *dp++=p0|(d0<<16); *dp++=p1|(d1<<16);
-                *dp++=p2|(d2<<16); *dp++=p2|(d3<<16);
-                *dp++=p3|(d4<<16); *dp++=p4|(d5<<16);
-                *dp++=p5|(d5<<16); *dp++=p6|(d6<<16);
-            }
-        } else if (do_scanline) {
-            for (int g = 0; g < 36; g++) {
-                uint32_t p0=(*sp++&DM)>>1,p1=(*sp++&DM)>>1,p2=(*sp++&DM)>>1;
-                uint32_t p3=(*sp++&DM)>>1,p4=(*sp++&DM)>>1,p5=(*sp++&DM)>>1;
-                uint32_t p6=(*sp++&DM)>>1;
-                *dp++=p0|(p0<<16); *dp++=p1|(p1<<16);
-                *dp++=p2|(p2<<16); *dp++=p2|(p3<<16);
-                *dp++=p3|(p4<<16); *dp++=p4|(p5<<16);
-                *dp++=p5|(p5<<16); *dp++=p6|(p6<<16);
-            }
-        } else {
-            for (int g = 0; g < 36; g++) {
-                uint32_t p0=*sp++,p1=*sp++,p2=*sp++,p3=*sp++,p4=*sp++,p5=*sp++,p6=*sp++;
-                *dp++=p0|(p0<<16); *dp++=p1|(p1<<16);
-                *dp++=p2|(p2<<16); *dp++=p2|(p3<<16);
-                *dp++=p3|(p4<<16); *dp++=p4|(p5<<16);
-                *dp++=p5|(p5<<16); *dp++=p6|(p6<<16);
-            }
-        }
+    if (timing->v_active_lines == VRes) {
+        // One output line per row: no line doubling, so no scanline darkening
+        int row = (int)active_line;
+        kernel_even(prefetch_src ? prefetch_row(row) : &DisplayBuf[row * row_bytes], buff + HSTX_LINE_PIXELS / 2,
+                    palette);
+        widen_line(buff);
+        if (prefetch_src)
+            prefetch_pump(row);
+        return;
+    }
 
-        // 32 px right black border (volatile: see left border above)
-        bp = dp;
-        for (int i = 0; i < 16; i++)
-            bp[i] = 0;
-        dp += 16;
-    } else {
-        const uint32_t *src = (const uint32_t *)&DisplayBuf[Line_dup * MODE_H_ACTIVE_PIXELS];
-        uint32_t *dst = buff;
-        const uint32_t iters = MODE_H_ACTIVE_PIXELS / 4; // 160
-
-        if (stype == 1) {
-            for (uint32_t i = 0; i < iters; i++) {
-                uint32_t pair = src[i];
-                if (do_scanline) pair = (pair & DARKEN_MASK) >> 1;
-                uint32_t px0 = pair & 0xFFFFu;
-                uint32_t px1 = pair >> 16;
-                // normal pixel in low half, darkened copy in high half
-                *dst++ = px0 | (((px0 & DM) >> 1) << 16);
-                *dst++ = px1 | (((px1 & DM) >> 1) << 16);
-            }
-        } else if (do_scanline) {
-            for (uint32_t i = 0; i < iters; i++) {
-                uint32_t pair = (src[i] & DARKEN_MASK) >> 1;
-                uint32_t px0 = pair & 0xFFFFu;
-                uint32_t px1 = pair >> 16;
-                *dst++ = px0 | (px0 << 16);
-                *dst++ = px1 | (px1 << 16);
-            }
+    int Line_dup = active_line >> 1;
+    if (active_line & 1) {
+        if (cached_row == Line_dup && cached_line != buff) {
+            cached_row = -1;
+            odd_from_even(cached_line, buff);
         } else {
-            for (uint32_t i = 0; i < iters; i++) {
-                uint32_t pair = src[i];
-                uint32_t px0 = pair & 0xFFFFu;
-                uint32_t px1 = pair >> 16;
-                *dst++ = px0 | (px0 << 16);
-                *dst++ = px1 | (px1 << 16);
-            }
+            kernel_odd(prefetch_src ? prefetch_row(Line_dup) : &DisplayBuf[Line_dup * row_bytes], buff, palette_odd);
         }
+        if (prefetch_src)
+            prefetch_pump(Line_dup);
+    } else {
+        kernel_even(prefetch_src ? prefetch_row(Line_dup) : &DisplayBuf[Line_dup * row_bytes], buff, palette);
+        cached_line = buff;
+        cached_row = Line_dup;
     }
 }
 
+void hstx_setScanLines(int enable)
+{
+    // Set the scanlines effect flag
+    enableScanLines = enable ? 1 : 0;
+    select_kernels();
+}
+
+void hstx_setAspectRatio87(int enable)
+{
+    enableAspectRatio87 = enable ? 1 : 0;
+    select_kernels();
+}
+
+void hstx_setScanLineType(int type)
+{
+    scanlineType = type;
+    select_kernels();
+}
+
+uint16_t *__not_in_flash_func(hstx_getlineFromFramebuffer)(int scanline)
+{
+    return (uint16_t *)(WriteBuf + (scanline * HRes * 2));
+}
+
+uint8_t *__not_in_flash_func(hstx_getIndexedLineFromFramebuffer)(int scanline)
+{
+    return WriteBuf + scanline * HRes;
+}
+
+void hstx_setFramebufferFormat(hstx_fb_format_t format)
+{
+    fb_format = format;
+    select_kernels();
+}
+
+hstx_fb_format_t hstx_getFramebufferFormat(void)
+{
+    return fb_format;
+}
+
+uint8_t *hstx_getFramebufferSpare(size_t *out_bytes)
+{
+    if (fb_format != HSTX_FB_INDEXED8)
+    {
+        if (out_bytes)
+            *out_bytes = 0;
+        return NULL;
+    }
+    if (out_bytes)
+        *out_bytes = HSTX_FRAMEBUFFER_BYTES - HRes * VRes;
+    return FRAMEBUFFER + HRes * VRes;
+}
+
+void hstx_setPalette(const uint16_t *colors, int first, int count)
+{
+    if (first < 0 || count <= 0 || first + count > 256)
+        return;
+    for (int i = 0; i < count; i++)
+    {
+        uint16_t c = colors[i] & 0x7FFFu;
+        palette[first + i] = c;
+        palette_dark[first + i] = (c & 0x7BDEu) >> 1;
+    }
+}
+
+void __not_in_flash_func(hstx_vsync_callbackfunc)(void)
+{
+   HSTX_vblank = true;
+   uint32_t now = time_us_32();
+   uint32_t period = now - last_vsync_us;
+   if (period > 10000 && period < 30000)
+   {
+       frame_period_us = period;
+   }
+   last_vsync_us = now;
+   swapchain_flip(now);
+   prefetch_frame_start();
+   // Wake core0 if it is sleeping in a frame wait
+   __sev();
+}
+
 extern volatile uint32_t video_frame_count;
 uint32_t hstx_getframecounter(void)
 {
     return video_frame_count;
 }
 
+// Raw samples on their way to hstx_audio_task on core 1, which owns the
+// packet assembly, the IEC 60958 frame counter and the encoding. Producers
+// only copy samples and publish the head, so the emulator core never runs
+// TERC4. The FIFO is single producer: the head is read, filled and
+// published without a lock, so only one caller may push at a time (the
+// emulator or the menu wavplayer, never both). Either core can be that
+// producer; a mixer on core 1 has to feed the FIFO through it rather than
+// push alongside it. Indices are free running.
+_Static_assert((HSTX_AUDIO_FIFO_SAMPLES & (HSTX_AUDIO_FIFO_SAMPLES - 1)) == 0,
+               "HSTX_AUDIO_FIFO_SAMPLES must be a power of two");
+static audio_sample_t audio_fifo[HSTX_AUDIO_FIFO_SAMPLES];
+static volatile uint32_t audio_fifo_head = 0;
+static volatile uint32_t audio_fifo_tail = 0;
+static int g_hdmi_audio_frame_counter = 0; // owned by hstx_audio_task
+
+// Samples the producer may still add: the FIFO and the data island queue
+// together hold at most HSTX_AUDIO_DI_HIGH_WATERMARK packets, above that new
+// samples are dropped.
+static inline uint32_t audio_fifo_room(uint32_t head)
+{
+    uint32_t queued = head - audio_fifo_tail + hstx_di_queue_get_level() * 4;
+    uint32_t limit = HSTX_AUDIO_DI_HIGH_WATERMARK * 4;
+    if (limit > HSTX_AUDIO_FIFO_SAMPLES)
+        limit = HSTX_AUDIO_FIFO_SAMPLES;
+    return queued >= limit ? 0 : limit - queued;
+}
+
 void __not_in_flash_func(hstx_push_audio_sample)(const int left, const int right)
 {
-    static int g_hdmi_audio_frame_counter = 0;
-    static audio_sample_t acc_buf[4];
-    static int acc_count = 0;
-    static  uint32_t video_frame_count = 0;
-    // Masked index + >= reset: if two producers ever race this function
-    // (menu wavplayer on core0 vs a core1 mixer), a lost update could step
-    // acc_count past 4 — with an exact == check that would never reset
-    // again and acc_buf[acc_count] would write through adjacent memory at
-    // the audio sample rate. The mask bounds every write; >= guarantees
-    // the reset. Costs one AND per sample.
-    acc_buf[acc_count & 3].left = left;
-    acc_buf[acc_count & 3].right = right;
-    acc_count++;
-    if (acc_count >= 4)
+    uint32_t head = audio_fifo_head;
+    if (!audio_fifo_room(head))
+        return;
+    audio_fifo[head & (HSTX_AUDIO_FIFO_SAMPLES - 1)].left = left;
+    audio_fifo[head & (HSTX_AUDIO_FIFO_SAMPLES - 1)].right = right;
+    // Publish the sample before the head, the task may run on the other core
+    __dmb();
+    audio_fifo_head = head + 1;
+}
+
+int __not_in_flash_func(hstx_push_audio_block)(const audio_sample_t *samples, int count)
+{
+    uint32_t head = audio_fifo_head;
+    uint32_t room = audio_fifo_room(head);
+    if ((uint32_t)count > room)
+        count = (int)room;
+    for (int i = 0; i < count; i++, head++)
     {
-        if (hstx_di_queue_get_level() >= HSTX_AUDIO_DI_HIGH_WATERMARK)
-        {
-            acc_count = 0;
-            return;
-        }
+        audio_fifo[head & (HSTX_AUDIO_FIFO_SAMPLES - 1)].left = samples[i].left;
+        audio_fifo[head & (HSTX_AUDIO_FIFO_SAMPLES - 1)].right = samples[i].right;
+    }
+    __dmb();
+    audio_fifo_head = head;
+    return count;
+}
+
+uint32_t __not_in_flash_func(hstx_audio_queued_packets)(void)
+{
+    return (audio_fifo_head - audio_fifo_tail) / 4 + hstx_di_queue_get_level();
+}
+
+// Moves whole packets from the FIFO into the data island queue, up to the
+// high watermark. Runs in the core 1 loop between DMA IRQs, which preempt it.
+bool __not_in_flash_func(hstx_audio_task)(void)
+{
+    uint32_t start = audio_fifo_tail;
+    uint32_t tail = start;
+    while (audio_fifo_head - tail >= 4 && hstx_di_queue_get_level() < HSTX_AUDIO_DI_HIGH_WATERMARK)
+    {
+        audio_sample_t samples[4];
+        for (int i = 0; i < 4; i++)
+            samples[i] = audio_fifo[(tail + i) & (HSTX_AUDIO_FIFO_SAMPLES - 1)];
+#if HSTX_DI_QUEUE_COMPACT
+        // Encoded by the DMA IRQ when the packet is about to be sent
+        if (!hstx_di_queue_push_samples(samples, g_hdmi_audio_frame_counter))
+            break;
+        g_hdmi_audio_frame_counter = (g_hdmi_audio_frame_counter + 4) % 192;
+#else
         hstx_packet_t packet;
         // _cs variant: carries IEC 60958 channel status with a valid
         // sample-frequency code. Strict HDMI sinks mute all-zero channel
         // status even with a correct Audio InfoFrame; lax sinks (capture
         // cards) decode it but with glitches.
-        g_hdmi_audio_frame_counter = hstx_packet_set_audio_samples_cs(&packet, acc_buf, 4, g_hdmi_audio_frame_counter);
-
+        int next_frame = hstx_packet_set_audio_samples_cs(&packet, samples, 4, g_hdmi_audio_frame_counter);
         hstx_data_island_t island;
         hstx_encode_data_island(&island, &packet, false, true);
-        (void)hstx_di_queue_push(&island);
-        acc_count = 0;
+        if (!hstx_di_queue_push(&island))
+            break;
+        g_hdmi_audio_frame_counter = next_frame;
+#endif
+        tail += 4;
+        // The samples are read, the producer may reuse their slots
+        audio_fifo_tail = tail;
     }
+    return tail != start;
 }
+
 // core1 boot stack — two variants:
 //
 // Opt-in (HSTX_CORE1_STACK_IN_SCRATCH_X=1, set by the app's CMake): use
@@ -345,6 +871,14 @@ void *hstx_default_core1_stack(size_t *out_bytes)
 
 void hstx_init(bool dviOnly)
 {
+    if (!FRAMEBUFFER)
+    {
+        // HSTX_FRAMEBUFFER_PSRAM without PSRAM
+        uint8_t *fb = (uint8_t *)malloc(HSTX_FRAMEBUFFER_BYTES);
+        if (!fb)
+            panic("HSTX: cannot allocate the framebuffer\n");
+        hstx_setFramebufferMemory(fb);
+    }
     s_hstx_dvi_mode = dviOnly;
     video_output_set_dvi_mode(dviOnly);
     hstx_di_queue_init();
@@ -352,6 +886,7 @@ void hstx_init(bool dviOnly)
     video_output_init(640, 480);
     pico_hdmi_set_audio_sample_rate(44100);
     video_output_set_scanline_callback(scanline_callbackfunc);
+    video_output_set_audio_task(hstx_audio_task);
     size_t stack_bytes;
     uint32_t *stack = (uint32_t *)hstx_default_core1_stack(&stack_bytes);
     multicore_launch_core1_with_stack(video_output_core1_run, stack, stack_bytes);
@@ -373,6 +908,9 @@ void hstx_restart_core1(uint32_t *new_stack, size_t new_stack_bytes)
     // running any other rate.
     uint32_t audio_rate = pico_hdmi_get_audio_sample_rate();
 
+    // Stop feeding the audio path; video_output_stop then waits for core1 to
+    // finish the task in flight before it is reset.
+    video_output_set_audio_task(NULL);
     video_output_stop();
     multicore_reset_core1();
 
@@ -386,6 +924,7 @@ void hstx_restart_core1(uint32_t *new_stack, size_t new_stack_bytes)
     video_output_init(640, 480);
     pico_hdmi_set_audio_sample_rate(audio_rate);
     video_output_set_scanline_callback(scanline_callbackfunc);
+    video_output_set_audio_task(hstx_audio_task);
 
     multicore_launch_core1_with_stack(video_output_core1_run, new_stack, new_stack_bytes);
 }
@@ -16,17 +16,132 @@ extern volatile bool HSTX_vblank;
 #ifndef HSTX_AUDIO_DI_HIGH_WATERMARK
 #define HSTX_AUDIO_DI_HIGH_WATERMARK 200  // ~16–18 ms at 4 samples/packet
 #endif
+// Raw stereo samples between the producers and hstx_audio_task, power of two.
+// The FIFO and the data island queue together never hold more than
+// HSTX_AUDIO_DI_HIGH_WATERMARK packets, so a FIFO of 4 x the watermark lets a
+// whole burst wait for the task.
+#ifndef HSTX_AUDIO_FIFO_SAMPLES
+#define HSTX_AUDIO_FIFO_SAMPLES 1024
+#endif
+// Framebuffer size, 320x240 RGB555
+#define HSTX_FRAMEBUFFER_BYTES (320 * 240 * 2)
+// Width of the lines the row kernels produce: 640 pixels, two per word. In
+// the 1280x240 mode the scanline callback repeats every pixel once more.
+#define HSTX_LINE_PIXELS 640
+// 1: no framebuffer in SRAM. Place it with hstx_setFramebufferMemory() (e.g.
+// in PSRAM) before hstx_init(), which otherwise takes it from the heap.
+#ifndef HSTX_FRAMEBUFFER_PSRAM
+#define HSTX_FRAMEBUFFER_PSRAM 0
+#endif
+// With HSTX_FRAMEBUFFER_PSRAM: rows of the SRAM ring that framebuffer rows
+// outside SRAM are prefetched into by DMA during scanout
+// (HSTX_PREFETCH_ROWS - 1 rows ahead). Without it there is no ring and every
+// framebuffer is read directly, so all of them must be in SRAM.
+#ifndef HSTX_PREFETCH_ROWS
+#define HSTX_PREFETCH_ROWS 4
+#endif
+#if HSTX_PREFETCH_ROWS < 2
+#error "HSTX_PREFETCH_ROWS must be at least 2"
+#endif
 uint32_t hstx_getframecounter(void);
 void hstx_waitForVSync(void);
-void hstx_paceFrame(bool init);
+// Paces the caller to the frame rate set with hstx_setFrameRate. Returns the
+// number of display frames dropped to resync after an overrun, 0 when on time.
+int hstx_paceFrame(bool init);
+// Emulated frame rate used by hstx_paceFrame, in Hz as num / den
+// (e.g. 4194304 / 70224 for the Game Boy). Default 598261 / 10000 (PCE NTSC).
+void hstx_setFrameRate(uint32_t num, uint32_t den);
+// Function called repeatedly while hstx_waitForVSync/hstx_paceFrame wait for
+// the next frame, with the estimated start of that frame (time_us_32() time
+// base). It returns false when it had nothing to run, the wait then sleeps in
+// WFE until the next event. NULL (default) always sleeps.
+void hstx_setWaitHook(bool (*hook)(uint32_t deadline_us));
 uint8_t *hstx_getframebuffer(void);
+// Moves the built-in framebuffer to buffer (HSTX_FRAMEBUFFER_BYTES, word
+// aligned). With HSTX_FRAMEBUFFER_PSRAM, rows of a buffer outside SRAM are
+// prefetched for scanout.
+void hstx_setFramebufferMemory(uint8_t *buffer);
+// Lines for which a prefetched row had not arrived yet and scanout waited.
+// Always 0 without HSTX_FRAMEBUFFER_PSRAM.
+uint32_t hstx_getPrefetchStalls(void);
 void hstx_setScanLines(int enable);
 void hstx_setAspectRatio87(int enable);
 void hstx_setScanLineType(int type);
 uint16_t *hstx_getlineFromFramebuffer(int scanline);
+// Framebuffer pixel format, RGB555 by default. HSTX_FB_INDEXED8 uses 320x240
+// 8-bit palette indices (the first 76,800 bytes of the framebuffer) expanded
+// through a 256-entry RGB555 palette during scanout, with the same 8:7 and
+// scanline options. Palette changes take effect from the next scanline.
+typedef enum
+{
+    HSTX_FB_RGB555 = 0,
+    HSTX_FB_INDEXED8 = 1,
+} hstx_fb_format_t;
+void hstx_setFramebufferFormat(hstx_fb_format_t format);
+hstx_fb_format_t hstx_getFramebufferFormat(void);
+uint8_t *hstx_getIndexedLineFromFramebuffer(int scanline);
+// Sets count palette entries starting at first, colors in RGB555.
+void hstx_setPalette(const uint16_t *colors, int first, int count);
+// In HSTX_FB_INDEXED8 mode the second half of the framebuffer (76,800 bytes)
+// is unused and may be borrowed by the emulator. Its contents are lost when
+// the format is switched back to RGB555, which the menus do. NULL in RGB555 mode.
+uint8_t *hstx_getFramebufferSpare(size_t *out_bytes);
+// Row kernel: expands one framebuffer row into a full output line. pal is the
+// palette for indexed rows, already the darkened one for darkened lines.
+typedef void (*hstx_row_kernel_t)(const uint8_t *row, uint32_t *buff, const uint16_t *pal);
+// Horizontal scaler, a kernel per [indexed][lcd column effect][darkened line].
+// Define one with HSTX_SCALER() from hstx_scaler.h.
+typedef struct
+{
+    hstx_row_kernel_t kernels[2][2][2];
+} hstx_scaler_t;
+// Scaler used instead of the NES 8:7 one when the aspect ratio mode is
+// enabled (hstx_setAspectRatio87). NULL restores the 8:7 scaler. The scaler
+// must stay valid while it is set.
+void hstx_setAspectScaler(const hstx_scaler_t *scaler);
+// Swap chain for tear-free page flipping. Buffers are 320x240 in the current
+// framebuffer format (153,600 bytes RGB555, 76,800 bytes indexed), in SRAM, or
+// PSRAM with HSTX_FRAMEBUFFER_PSRAM; a NULL entry (at most one) is the built-in framebuffer. In
+// HSTX_FB_INDEXED8 mode the spare half (hstx_getFramebufferSpare) fits a
+// second buffer. count 1 returns to single buffering, the default.
+//
+// Per frame: render into hstx_acquireBackBuffer() (hstx_getlineFromFramebuffer
+// and hstx_getframebuffer address the same buffer), then hstx_present(). The
+// buffer is shown from the next vsync on. With two buffers acquire waits for
+// the previous frame to flip; with three it never waits, and a frame that is
+// replaced by a newer one before its vsync is dropped.
+#define HSTX_SWAPCHAIN_MAX_BUFFERS 3
+typedef struct
+{
+    uint32_t presented;      // hstx_present calls
+    uint32_t flipped;        // presented frames that were scanned out
+    uint32_t dropped;        // presented frames replaced before their vsync
+    uint32_t duplicated;     // vsyncs without a new frame, frame shown again
+    uint32_t latency_avg_us; // present to vsync flip
+    uint32_t latency_max_us;
+} hstx_swapchain_stats_t;
+bool hstx_swapchainInit(uint8_t *const buffers[], int count);
+uint8_t *hstx_acquireBackBuffer(void);
+void hstx_present(void);
+// Paused, the built-in framebuffer is displayed and written directly, as the
+// menus expect. Resuming shows the last flipped frame again.
+void hstx_setSwapchainPaused(bool paused);
+void hstx_getSwapchainStats(hstx_swapchain_stats_t *stats);
 void hstx_init(bool dviOnly);
 void video_output_core1_run(void);
+// HDMI audio. The push functions only copy samples into a FIFO; packets are
+// assembled and encoded by hstx_audio_task on core 1. Samples that would take
+// the buffered audio above HSTX_AUDIO_DI_HIGH_WATERMARK packets are dropped.
 void hstx_push_audio_sample(const int left, const int right);
+// Queues count stereo samples, mixes freely with hstx_push_audio_sample.
+// Returns the number of samples accepted.
+int hstx_push_audio_block(const audio_sample_t *samples, int count);
+// Audio buffered for HDMI, FIFO and data island queue, in 4-sample packets.
+uint32_t hstx_audio_queued_packets(void);
+// Installed as core 1's audio hook (video_output_set_audio_task) by
+// hstx_init; the background task slot stays free for the application.
+// Returns true when it moved at least one packet.
+bool hstx_audio_task(void);
 
 // Tear HSTX + core1 down and re-launch core1 with the supplied stack
 // buffer. Used by pico-pcePlus to grow core1's stack at runtime when a
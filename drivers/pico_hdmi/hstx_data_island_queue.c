@@ -8,6 +8,9 @@
 #include <stdio.h>
 #include "pico.h"
 #include "hardware/sync.h"  // __dmb
+// Producers that push a frame of audio at once need ~200 entries at 48 kHz
+// and 400 at 96 kHz (tests/host/di_line_clock_sim.c); the queue depth comes
+// from the burst size, not from the scheduler.
 #ifndef DI_RING_BUFFER_SIZE
 #define DI_RING_BUFFER_SIZE 256
 #endif
@@ -16,16 +19,32 @@
 // its shortptr zone (SHORTPTR_BASE + 0x40000 = 0x20076000), reclaiming the
 // 36 KB the malloc path would otherwise steal from Doom's heap. When unset,
 // the driver falls back to its historical malloc-on-first-init behaviour.
+#if HSTX_DI_QUEUE_COMPACT
+// Raw audio packet, encoded when it is dequeued
+typedef struct {
+    audio_sample_t samples[4];
+    uint32_t frame_count;
+} di_ring_entry_t;
+#else
+typedef hstx_data_island_t di_ring_entry_t;
+#endif
 #ifdef HSTX_DI_RING_ADDRESS
-static hstx_data_island_t *const di_ring_buffer = (hstx_data_island_t *)(HSTX_DI_RING_ADDRESS);
+static di_ring_entry_t *const di_ring_buffer = (di_ring_entry_t *)(HSTX_DI_RING_ADDRESS);
 #else
-static hstx_data_island_t *di_ring_buffer = NULL; // [DI_RING_BUFFER_SIZE]
+static di_ring_entry_t *di_ring_buffer = NULL; // [DI_RING_BUFFER_SIZE]
 #endif
 static volatile uint32_t di_ring_head = 0;
 static volatile uint32_t di_ring_tail = 0;
 
 // Single pre-encoded silent audio packet (fixed B-frame flags).
 static hstx_data_island_t silence_packet;
+#if HSTX_DI_QUEUE_COMPACT
+// The next packets, already encoded: staged_count of them starting at
+// staged_first, enough for the fullest line. Owned by the DMA IRQ.
+static hstx_data_island_t staged_island[HSTX_DI_MAX_PACKETS_PER_LINE];
+static uint32_t staged_first = 0;
+static volatile uint32_t staged_count = 0;
+#endif
 
 // Audio packet scheduler — exact rational arithmetic, zero long-term
 // drift. Accumulate `sample_rate` per scanline; a 4-sample packet is due
@@ -34,8 +53,9 @@ static hstx_data_island_t silence_packet;
 // (32000/60 -> 533, i.e. 31980 samples/s), a -20 sample/s deficit
 // against the ACR-derived sink clock that drained the sink's audio FIFO
 // roughly every 6 s — an audible dropout while the receiver re-locked.
-// Line rate follows from the 25.2 MHz pixel clock both video modes use.
-#define DI_LINE_RATE_HZ (25200000u / MODE_H_TOTAL_PIXELS)
+// The line rate depends on the video mode (31.5 kHz at 480p, 15.75 kHz at
+// 240p) and is set by video_output when the mode changes.
+static uint32_t di_line_rate_hz = MODE_PIXEL_CLOCK_HZ / 800;
 static uint32_t audio_sample_accum = 0;      // unit: samples x line-rate
 static uint32_t audio_samples_per_sec = 48000;
 extern void * frens_f_malloc(size_t size);
@@ -44,16 +64,20 @@ void hstx_di_queue_init(void)
     di_ring_head = 0;
     di_ring_tail = 0;
     audio_sample_accum = 0;
+#if HSTX_DI_QUEUE_COMPACT
+    staged_first = 0;
+    staged_count = 0;
+#endif
     // Allocate memory for the ring buffer (skipped when the address was
     // pinned at compile time via HSTX_DI_RING_ADDRESS).
 #ifdef HSTX_DI_RING_ADDRESS
     printf("HSTX DI ring buffer at fixed %p (%u bytes)\n",
            (void *)di_ring_buffer,
-           (unsigned)(DI_RING_BUFFER_SIZE * sizeof(hstx_data_island_t)));
+           (unsigned)(DI_RING_BUFFER_SIZE * sizeof(di_ring_entry_t)));
 #else
     if (di_ring_buffer == NULL) {
-        printf("Allocating memory for HSTX DI ring buffer: %d bytes\n", DI_RING_BUFFER_SIZE * sizeof(hstx_data_island_t));
-        di_ring_buffer = (hstx_data_island_t *)malloc(DI_RING_BUFFER_SIZE * sizeof(hstx_data_island_t));
+        printf("Allocating memory for HSTX DI ring buffer: %d bytes\n", DI_RING_BUFFER_SIZE * sizeof(di_ring_entry_t));
+        di_ring_buffer = (di_ring_entry_t *)malloc(DI_RING_BUFFER_SIZE * sizeof(di_ring_entry_t));
     }
 #endif
     // Build a single silent audio packet. frame_count=4 (NOT 0): frame 0
@@ -71,11 +95,38 @@ void hstx_di_queue_set_sample_rate(uint32_t sample_rate)
     audio_sample_accum = 0;
 }
 
+void hstx_di_queue_set_line_rate(uint32_t line_rate_hz)
+{
+    di_line_rate_hz = line_rate_hz;
+    audio_sample_accum = 0;
+}
+
+// Counts packets rejected by hstx_di_queue_push because the queue was full.
+static volatile uint32_t di_overrun_count = 0;
+
+#if HSTX_DI_QUEUE_COMPACT
+bool __not_in_flash_func(hstx_di_queue_push_samples)(const audio_sample_t *samples, int frame_count)
+{
+    uint32_t next_head = (di_ring_head + 1) % DI_RING_BUFFER_SIZE;
+    if (next_head == di_ring_tail) {
+        di_overrun_count++;
+        return false;
+    }
+
+    volatile di_ring_entry_t *dst = &di_ring_buffer[di_ring_head];
+    for (int i = 0; i < 4; i++) {
+        dst->samples[i].left = samples[i].left;
+        dst->samples[i].right = samples[i].right;
+    }
+    dst->frame_count = (uint32_t)frame_count;
+#else
 bool __not_in_flash_func(hstx_di_queue_push)(const hstx_data_island_t *island)
 {
     uint32_t next_head = (di_ring_head + 1) % DI_RING_BUFFER_SIZE;
-    if (next_head == di_ring_tail)
+    if (next_head == di_ring_tail) {
+        di_overrun_count++;
         return false;
+    }
 
     // Volatile word copy instead of struct assignment: keeps the copy inline
     // so this SRAM function never calls the flash-resident libc memcpy.
@@ -83,6 +134,7 @@ bool __not_in_flash_func(hstx_di_queue_push)(const hstx_data_island_t *island)
     const uint32_t *src = island->words;
     for (size_t i = 0; i < count_of(island->words); i++)
         dst[i] = src[i];
+#endif
     // Publish payload before head: the consumer (DMA IRQ on the other core)
     // must never observe the head advance ahead of the payload words.
     __dmb();
@@ -94,11 +146,39 @@ uint32_t __not_in_flash_func(hstx_di_queue_get_level)(void)
 {
     uint32_t head = di_ring_head;
     uint32_t tail = di_ring_tail;
-    if (head >= tail)
-        return head - tail;
-    return DI_RING_BUFFER_SIZE + head - tail;
+    uint32_t level = head >= tail ? head - tail : DI_RING_BUFFER_SIZE + head - tail;
+#if HSTX_DI_QUEUE_COMPACT
+    level += staged_count;
+#endif
+    return level;
+}
+
+#if HSTX_DI_QUEUE_COMPACT
+// Encodes the oldest queued packet into out and releases its entry.
+static void __not_in_flash_func(encode_tail)(hstx_data_island_t *out)
+{
+    const di_ring_entry_t *e = &di_ring_buffer[di_ring_tail];
+    hstx_packet_t packet;
+    (void)hstx_packet_set_audio_samples_cs(&packet, e->samples, 4, (int)e->frame_count);
+    hstx_encode_data_island(out, &packet, false, true);
+    // The entry is only released once it has been read
+    __dmb();
+    di_ring_tail = (di_ring_tail + 1) % DI_RING_BUFFER_SIZE;
 }
 
+// Lines without a call (vsync) only send, so the staged packets cover the
+// lines after them.
+void __not_in_flash_func(hstx_di_queue_stage)(void)
+{
+    for (int n = 0; n < HSTX_DI_STAGE_MAX_ENCODES; n++) {
+        if (staged_count == HSTX_DI_MAX_PACKETS_PER_LINE || di_ring_tail == di_ring_head)
+            return;
+        encode_tail(&staged_island[(staged_first + staged_count) % HSTX_DI_MAX_PACKETS_PER_LINE]);
+        staged_count++;
+    }
+}
+#endif
+
 void __not_in_flash_func(hstx_di_queue_tick)(void)
 {
     audio_sample_accum += audio_samples_per_sec;
@@ -109,25 +189,63 @@ void __not_in_flash_func(hstx_di_queue_tick)(void)
 // silence that was genuinely mixed into the stream.
 static volatile uint32_t di_underrun_count = 0;
 
-const uint32_t *__not_in_flash_func(hstx_di_queue_get_audio_packet)(void)
+// Dequeues the next packet of the current line, NULL when the queue holds
+// one that is not ready to send yet.
+static inline const uint32_t *__not_in_flash_func(next_audio_packet)(void)
+{
+#if HSTX_DI_QUEUE_COMPACT
+    // Only staged packets are sent, so no line encodes on its own time. A
+    // packet queued since the last stage stays due for a later line.
+    // build_line_with_di copies the words before the next stage.
+    if (staged_count) {
+        const uint32_t *words = staged_island[staged_first].words;
+        staged_first = (staged_first + 1) % HSTX_DI_MAX_PACKETS_PER_LINE;
+        staged_count--;
+        return words;
+    }
+    if (di_ring_tail != di_ring_head)
+        return NULL;
+#else
+    if (di_ring_tail != di_ring_head) {
+        const uint32_t *words = di_ring_buffer[di_ring_tail].words;
+        di_ring_tail = (di_ring_tail + 1) % DI_RING_BUFFER_SIZE;
+        return words;
+    }
+#endif
+    // Queue is empty: return a pre-encoded silent packet to keep HDMI audio active.
+    di_underrun_count++;
+    return silence_packet.words;
+}
+
+int __not_in_flash_func(hstx_di_queue_get_audio_packets)(const uint32_t **packets, int max)
 {
-    // Check if it's time to send a 4-sample audio packet (every ~3.9 lines
-    // at 32 kHz / 31.5 kHz line rate)
-    if (audio_sample_accum >= 4u * DI_LINE_RATE_HZ) {
-        audio_sample_accum -= 4u * DI_LINE_RATE_HZ;
-        if (di_ring_tail != di_ring_head) {
-            const uint32_t *words = di_ring_buffer[di_ring_tail].words;
-            di_ring_tail = (di_ring_tail + 1) % DI_RING_BUFFER_SIZE;
-            return words;
-        }
-        // Queue is empty: return a pre-encoded silent packet to keep HDMI audio active.
-        di_underrun_count++;
-        return silence_packet.words;
+    // A 4-sample audio packet is due every time the accumulator reaches
+    // 4 x line rate (every ~3.9 lines at 32 kHz / 31.5 kHz line rate)
+    if (max > HSTX_DI_MAX_PACKETS_PER_LINE)
+        max = HSTX_DI_MAX_PACKETS_PER_LINE;
+    int n = 0;
+    while (n < max && audio_sample_accum >= 4u * di_line_rate_hz) {
+        const uint32_t *words = next_audio_packet();
+        if (!words)
+            break;
+        audio_sample_accum -= 4u * di_line_rate_hz;
+        packets[n++] = words;
     }
-    return NULL;
+    return n;
+}
+
+const uint32_t *__not_in_flash_func(hstx_di_queue_get_audio_packet)(void)
+{
+    const uint32_t *words;
+    return hstx_di_queue_get_audio_packets(&words, 1) ? words : NULL;
 }
 
 uint32_t hstx_di_queue_get_underrun_count(void)
 {
     return di_underrun_count;
 }
+
+uint32_t hstx_di_queue_get_overrun_count(void)
+{
+    return di_overrun_count;
+}
@@ -6,6 +6,40 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * HSTX_DI_QUEUE_COMPACT=1: the queue holds the four stereo samples and IEC
+ * 60958 frame counter of each audio packet (20 bytes) instead of the encoded
+ * 36-word data island (144 bytes), 5 KB instead of 36 KB for 256 entries.
+ * The DMA IRQ encodes up to HSTX_DI_MAX_PACKETS_PER_LINE packets ahead of
+ * time on lines with slack (hstx_di_queue_stage), and the line that sends
+ * them only copies them. A packet that is queued but not yet staged stays
+ * due for a later line. hstx_di_queue_push is not available in this mode.
+ */
+#ifndef HSTX_DI_QUEUE_COMPACT
+#define HSTX_DI_QUEUE_COMPACT 0
+#endif
+
+/**
+ * Most packets hstx_di_queue_stage encodes in one call, which bounds the
+ * time it adds to a line. 96 kHz audio needs 1.5 packets per line at 240p.
+ */
+#ifndef HSTX_DI_STAGE_MAX_ENCODES
+#define HSTX_DI_STAGE_MAX_ENCODES 2
+#endif
+
+/**
+ * Most audio packets one line's data island may carry. Packets that fell due
+ * on lines without room for audio (vsync, ACR, AVI InfoFrame) go out together
+ * on the next line instead of one per line, so the scheduler never lags the
+ * sample clock by more than a line. video_output lowers the limit to what
+ * fits in the horizontal sync pulse of the current mode (2 at 480p). Packets
+ * never leave ahead of the sample clock: the sink's audio FIFO is not ours to
+ * fill.
+ */
+#ifndef HSTX_DI_MAX_PACKETS_PER_LINE
+#define HSTX_DI_MAX_PACKETS_PER_LINE 3
+#endif
+
 /**
  * Initialize the Data Island queue and scheduler.
  */
@@ -17,11 +51,33 @@ void hstx_di_queue_init(void);
  */
 void hstx_di_queue_set_sample_rate(uint32_t sample_rate);
 
+/**
+ * Set the video line rate the scheduler is ticked at.
+ * @param line_rate_hz Lines per second (pixel clock / total line width)
+ */
+void hstx_di_queue_set_line_rate(uint32_t line_rate_hz);
+
+#if HSTX_DI_QUEUE_COMPACT
+/**
+ * Push four stereo samples; frame_count is the IEC 60958 frame number
+ * (0..191) of the first one. Returns false if the queue is full.
+ */
+bool hstx_di_queue_push_samples(const audio_sample_t *samples, int frame_count);
+
+/**
+ * Encode the oldest queued packet into the staging islands unless all
+ * HSTX_DI_MAX_PACKETS_PER_LINE are taken, up to HSTX_DI_STAGE_MAX_ENCODES
+ * per call.
+ * Called by the DMA IRQ on lines that have time to spare.
+ */
+void hstx_di_queue_stage(void);
+#else
 /**
  * Push a pre-encoded Data Island into the queue.
  * Returns true if successful, false if the queue is full.
  */
 bool hstx_di_queue_push(const hstx_data_island_t *island);
+#endif
 
 /**
  * Get the current number of items in the queue.
@@ -41,10 +97,24 @@ void hstx_di_queue_tick(void);
  */
 const uint32_t *hstx_di_queue_get_audio_packet(void);
 
+/**
+ * Get up to max audio packets that are due (at most
+ * HSTX_DI_MAX_PACKETS_PER_LINE), oldest first. The pointers are valid until
+ * the next call or hstx_di_queue_stage.
+ * @return Number of packets, 0 if none is due.
+ */
+int hstx_di_queue_get_audio_packets(const uint32_t **packets, int max);
+
 /**
  * Number of silence-packet fallbacks since boot (a packet was due but the
  * queue was empty). Monotonic; diff between reads to detect underruns.
  */
 uint32_t hstx_di_queue_get_underrun_count(void);
 
+/**
+ * Number of packets rejected by hstx_di_queue_push because the queue was
+ * full since boot. Monotonic; diff between reads to detect overruns.
+ */
+uint32_t hstx_di_queue_get_overrun_count(void);
+
 #endif // HSTX_DATA_ISLAND_QUEUE_H
@@ -5,31 +5,51 @@
 
 // The per-audio-packet encode path (hstx_packet_set_audio_samples +
 // hstx_encode_data_island and their tables) is kept out of flash: it runs
-// ~46 times per frame on core0, and a flash fetch can stall behind QMI
-// traffic (CHD hunk decompress hammering PSRAM), delaying the audio push
-// long enough to drain the HDMI data-island queue.
+// ~46 times per frame on core1 (hstx_audio_task, or the DMA IRQ with
+// HSTX_DI_QUEUE_COMPACT), and a flash fetch can stall behind QMI traffic
+// (CHD hunk decompress hammering PSRAM) long enough to drain the HDMI
+// data-island queue or make the IRQ miss its line.
 
 // ============================================================================
 // TERC4 Symbol Table (4-bit to 10-bit encoding)
 // ============================================================================
 
+#define TERC4(n)                                                                                       \
+    ((n) == 0    ? 0b1010011100                                                                       \
+     : (n) == 1  ? 0b1001100011                                                                       \
+     : (n) == 2  ? 0b1011100100                                                                       \
+     : (n) == 3  ? 0b1011100010                                                                       \
+     : (n) == 4  ? 0b0101110001                                                                       \
+     : (n) == 5  ? 0b0100011110                                                                       \
+     : (n) == 6  ? 0b0110001110                                                                       \
+     : (n) == 7  ? 0b0100111100                                                                       \
+     : (n) == 8  ? 0b1011001100                                                                       \
+     : (n) == 9  ? 0b0100111001                                                                       \
+     : (n) == 10 ? 0b0110011100                                                                       \
+     : (n) == 11 ? 0b1011000110                                                                       \
+     : (n) == 12 ? 0b1010001110                                                                       \
+     : (n) == 13 ? 0b1001110001                                                                       \
+     : (n) == 14 ? 0b0101100011                                                                       \
+                 : 0b1011000011)
+
 static const uint16_t __not_in_flash("hstx_packet") ter_c4[16] = {
-    0b1010011100, // 0
-    0b1001100011, // 1
-    0b1011100100, // 2
-    0b1011100010, // 3
-    0b0101110001, // 4
-    0b0100011110, // 5
-    0b0110001110, // 6
-    0b0100111100, // 7
-    0b1011001100, // 8
-    0b0100111001, // 9
-    0b0110011100, // 10
-    0b1011000110, // 11
-    0b1010001110, // 12
-    0b1001110001, // 13
-    0b0101100011, // 14
-    0b1011000011, // 15
+    TERC4(0), TERC4(1), TERC4(2),  TERC4(3),  TERC4(4),  TERC4(5),  TERC4(6),  TERC4(7),
+    TERC4(8), TERC4(9), TERC4(10), TERC4(11), TERC4(12), TERC4(13), TERC4(14), TERC4(15),
+};
+
+// Lanes 1 and 2 of an HSTX word for a pair of subpacket nibbles: entry
+// (lane1 | lane2 << 4) holds both TERC4 symbols in place, so a packet word is
+// one lookup ORed with its lane 0 (header) symbol.
+#define LANE12(l1, l2) (((uint32_t)TERC4(l1) << 10) | ((uint32_t)TERC4(l2) << 20))
+#define LANE12_ROW(l2)                                                                                 \
+    LANE12(0, l2), LANE12(1, l2), LANE12(2, l2), LANE12(3, l2), LANE12(4, l2), LANE12(5, l2),          \
+        LANE12(6, l2), LANE12(7, l2), LANE12(8, l2), LANE12(9, l2), LANE12(10, l2), LANE12(11, l2),    \
+        LANE12(12, l2), LANE12(13, l2), LANE12(14, l2), LANE12(15, l2)
+
+static const uint32_t __not_in_flash("hstx_packet") lane12_table[256] = {
+    LANE12_ROW(0),  LANE12_ROW(1),  LANE12_ROW(2),  LANE12_ROW(3),  LANE12_ROW(4),  LANE12_ROW(5),
+    LANE12_ROW(6),  LANE12_ROW(7),  LANE12_ROW(8),  LANE12_ROW(9),  LANE12_ROW(10), LANE12_ROW(11),
+    LANE12_ROW(12), LANE12_ROW(13), LANE12_ROW(14), LANE12_ROW(15),
 };
 
 #define GUARD_BAND_SYMBOL 0x133u // 0b0100110011
@@ -324,34 +344,24 @@ int __not_in_flash_func(hstx_packet_set_audio_samples)(hstx_packet_t *packet, co
     return temp_frame_count;
 }
 
-static inline uint32_t make_hstx_word(uint16_t lane0, uint16_t lane1, uint16_t lane2)
-{
-    return (lane0 & 0x3FF) | ((lane1 & 0x3FF) << 10) | ((lane2 & 0x3FF) << 20);
-}
-
-static void __not_in_flash_func(encode_header_to_lane0)(const hstx_packet_t *packet, uint16_t *lane0, int hv, bool first_packet)
-{
-    int hv1 = hv | 0x08;
-    if (!first_packet)
-        hv = hv1;
-
-    int idx = 0;
-    for (int i = 0; i < 4; i++) {
-        uint8_t h = packet->header[i];
-        lane0[idx++] = ter_c4[((h << 2) & 4) | hv];
-        hv = hv1;
-        lane0[idx++] = ter_c4[((h << 1) & 4) | hv];
-        lane0[idx++] = ter_c4[(h & 4) | hv];
-        lane0[idx++] = ter_c4[((h >> 1) & 4) | hv];
-        lane0[idx++] = ter_c4[((h >> 2) & 4) | hv];
-        lane0[idx++] = ter_c4[((h >> 3) & 4) | hv];
-        lane0[idx++] = ter_c4[((h >> 4) & 4) | hv];
-        lane0[idx++] = ter_c4[((h >> 5) & 4) | hv];
-    }
-}
-
-static void __not_in_flash_func(encode_subpackets_to_lanes)(const hstx_packet_t *packet, uint16_t *lane1, uint16_t *lane2)
+void __not_in_flash_func(hstx_encode_data_island)(hstx_data_island_t *out, const hstx_packet_t *packet, bool vsync_active, bool hsync_active)
 {
+    // REVERTED: vsync_active/hsync_active indicate pulse region, not signal level
+    // For 640x480 (negative polarity), pulse region means signal=0
+    int hv = (vsync_active ? 0 : 2) | (hsync_active ? 0 : 1);
+    uint32_t *w = out->words + 2;
+
+    // Lane 0 carries one header bit per word in bit 2 of the TERC4 nibble,
+    // with hsync/vsync in bits 0-1 and bit 3 set on all but the first word.
+    uint32_t header = packet->header[0] | (packet->header[1] << 8) | (packet->header[2] << 16) |
+                      ((uint32_t)packet->header[3] << 24);
+    uint32_t sym0 = ter_c4[hv | 8];
+    uint32_t diff = sym0 ^ ter_c4[hv | 8 | 4];
+#define LANE0(bit) (sym0 ^ (diff & -((header >> (bit)) & 1)))
+
+    // Lanes 1 and 2: transpose byte i of the four subpackets so that each
+    // nibble pair indexes lane12_table (same bit order as the HDMI spec's
+    // per-clock layout), four words per byte position.
     for (int i = 0; i < 8; i++) {
         uint32_t v = (packet->subpacket[0][i] << 0) | (packet->subpacket[1][i] << 8) | (packet->subpacket[2][i] << 16) |
                      (packet->subpacket[3][i] << 24);
@@ -360,41 +370,35 @@ static void __not_in_flash_func(encode_subpackets_to_lanes)(const hstx_packet_t
         t = (v ^ (v >> 14)) & 0x0000cccc;
         v = v ^ t ^ (t << 14);
 
-        lane1[(i * 4) + 0] = ter_c4[(v >> 0) & 0xF];
-        lane1[(i * 4) + 1] = ter_c4[(v >> 16) & 0xF];
-        lane1[(i * 4) + 2] = ter_c4[(v >> 4) & 0xF];
-        lane1[(i * 4) + 3] = ter_c4[(v >> 20) & 0xF];
-
-        lane2[(i * 4) + 0] = ter_c4[(v >> 8) & 0xF];
-        lane2[(i * 4) + 1] = ter_c4[(v >> 24) & 0xF];
-        lane2[(i * 4) + 2] = ter_c4[(v >> 12) & 0xF];
-        lane2[(i * 4) + 3] = ter_c4[(v >> 28) & 0xF];
+        w[(i * 4) + 0] = lane12_table[(v & 0x0F) | ((v >> 4) & 0xF0)] | LANE0(i * 4 + 0);
+        w[(i * 4) + 1] = lane12_table[((v >> 16) & 0x0F) | ((v >> 20) & 0xF0)] | LANE0(i * 4 + 1);
+        w[(i * 4) + 2] = lane12_table[((v >> 4) & 0x0F) | ((v >> 8) & 0xF0)] | LANE0(i * 4 + 2);
+        w[(i * 4) + 3] = lane12_table[((v >> 20) & 0x0F) | ((v >> 24) & 0xF0)] | LANE0(i * 4 + 3);
     }
-}
-
-void __not_in_flash_func(hstx_encode_data_island)(hstx_data_island_t *out, const hstx_packet_t *packet, bool vsync_active, bool hsync_active)
-{
-    // REVERTED: vsync_active/hsync_active indicate pulse region, not signal level
-    // For 640x480 (negative polarity), pulse region means signal=0
-    int hv = (vsync_active ? 0 : 2) | (hsync_active ? 0 : 1);
-    uint16_t lane0[32];
-    uint16_t lane1[32];
-    uint16_t lane2[32];
-
-    encode_header_to_lane0(packet, lane0, hv, true);
-    encode_subpackets_to_lanes(packet, lane1, lane2);
-
-    uint16_t gb_lane0 = ter_c4[0xC | hv];
-    uint32_t guard_word = make_hstx_word(gb_lane0, GUARD_BAND_SYMBOL, GUARD_BAND_SYMBOL);
+#undef LANE0
+    // The first word has bit 3 of the lane 0 nibble clear
+    w[0] ^= (ter_c4[hv | ((header & 1) << 2)] ^ ter_c4[hv | 8 | ((header & 1) << 2)]);
 
+    uint32_t gb_lane0 = ter_c4[0xC | hv];
+    uint32_t guard_word = gb_lane0 | (GUARD_BAND_SYMBOL << 10) | (GUARD_BAND_SYMBOL << 20);
     out->words[0] = guard_word;
     out->words[1] = guard_word;
-    for (int i = 0; i < 32; i++)
-        out->words[i + 2] = make_hstx_word(lane0[i], lane1[i], lane2[i]);
     out->words[34] = guard_word;
     out->words[35] = guard_word;
 }
 
+// Lane 0 of a packet's first word has bit 3 clear only at the start of the
+// island; a packet that follows another in the same island has it set.
+uint32_t __not_in_flash_func(hstx_data_island_continue_word)(uint32_t word)
+{
+    uint32_t sym = word & 0x3ffu;
+    for (int n = 0; n < 8; n++) {
+        if (ter_c4[n] == sym)
+            return (word & ~0x3ffu) | ter_c4[n | 8];
+    }
+    return word;
+}
+
 static hstx_data_island_t null_islands[4];
 static bool null_islands_initialized = false;
 
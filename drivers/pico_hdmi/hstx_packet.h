@@ -64,5 +64,9 @@ void hstx_packet_set_null(hstx_packet_t *packet);
 
 void hstx_encode_data_island(hstx_data_island_t *out, const hstx_packet_t *packet, bool vsync, bool hsync);
 const uint32_t *hstx_get_null_data_island(bool vsync, bool hsync);
+// Returns the first packet word (words[2]) of an encoded island, marked as
+// not being the start of the island, for packets sent back to back in one
+// data island period.
+uint32_t hstx_data_island_continue_word(uint32_t word);
 
 #endif // HSTX_PACKET_H
@@ -0,0 +1,113 @@
+#pragma once
+#if PICO_RP2350
+#include "pico.h"
+#include "hstx.h"
+
+// Compile-time generated horizontal scalers for the HSTX scanline callback.
+//
+// A scaler stretches a crop of each 320-pixel framebuffer row to a centred
+// span of the output line, black on both sides. The ratio is given as a
+// repeat period: src_period source pixels become dst_period output pixels,
+// repeated periods times. Source pixel of output pixel x within a period:
+//
+//     (2 * x * src_period + phase) / (2 * dst_period)
+//
+// HSTX_SCALER uses phase = src_period (sample at the output pixel centre).
+// All arguments are constants, so the period loop unrolls into straight
+// word stores with fixed source offsets, like a hand-written kernel.
+//
+// Examples, in a file scope of the emulator:
+//
+//     // NES 8:7: 252 px from column 34 -> 576 px (7 -> 16, 36 times)
+//     HSTX_SCALER(nes87, 34, 7, 16, 36);
+//     // Game Boy: 160 px at column 80 -> 480 px (1 -> 3, as 2 -> 6)
+//     HSTX_SCALER(gb3x, 80, 2, 6, 80);
+//     // SMS / Genesis H32: 256 px at column 32 -> 576 px (4 -> 9, as 8 -> 18)
+//     HSTX_SCALER(h32, 32, 8, 18, 32);
+//
+//     hstx_setAspectScaler(&gb3x);
+//
+// dst_period must be even (output words hold two pixels), the output span at
+// most the line width, the borders a whole number of words and src_period at
+// most HSTX_SCALER_MAX_PERIOD (the source pixels of a period are loaded once).
+#define HSTX_SCALER_MAX_PERIOD 32
+
+#ifdef __cplusplus
+#define HSTX_SCALER_ASSERT(cond, msg) static_assert(cond, msg)
+#else
+#define HSTX_SCALER_ASSERT(cond, msg) _Static_assert(cond, msg)
+#endif
+
+static inline __attribute__((always_inline)) uint32_t hstx_scaler_px(const uint8_t *row, int i, const uint16_t *pal,
+                                                                     const int indexed, const int dark)
+{
+    if (indexed)
+        return pal[row[i]];
+    uint32_t p = ((const uint16_t *)row)[i];
+    return dark ? (p & 0x7BDEu) >> 1 : p;
+}
+
+static inline __attribute__((always_inline)) void hstx_scale_row(const uint8_t *row, uint32_t *buff, const uint16_t *pal,
+                                                                 const int indexed, const int lcd, const int dark,
+                                                                 const int src_offset, const int src_period,
+                                                                 const int dst_period, const int periods, const int phase)
+{
+    const int border = (HSTX_LINE_PIXELS - dst_period * periods) / 4; // words each side
+    // Volatile stores so GCC cannot replace the border loops with a call to
+    // flash-resident memset: this runs in the scanline DMA IRQ.
+    volatile uint32_t *bp = buff;
+    for (int i = 0; i < border; i++)
+        bp[i] = 0;
+    uint32_t *dp = buff + border;
+    const uint8_t *sp = row + src_offset * (indexed ? 1 : 2);
+    for (int p = 0; p < periods; p++) {
+        uint32_t px[HSTX_SCALER_MAX_PERIOD];
+#pragma GCC unroll 64
+        for (int i = 0; i < src_period; i++)
+            px[i] = hstx_scaler_px(sp, i, pal, indexed, dark);
+#pragma GCC unroll 64
+        for (int x = 0; x < dst_period; x += 2) {
+            uint32_t lo = px[(2 * x * src_period + phase) / (2 * dst_period)];
+            uint32_t hi = px[(2 * (x + 1) * src_period + phase) / (2 * dst_period)];
+            if (lcd)
+                hi = (hi & 0x7BDEu) >> 1;
+            *dp++ = lo | (hi << 16);
+        }
+        sp += src_period * (indexed ? 1 : 2);
+    }
+    bp = dp;
+    for (int i = 0; i < border; i++)
+        bp[i] = 0;
+}
+
+#define HSTX_SCALER_KERNEL(name, indexed, lcd, dark, src_offset, src_period, dst_period, periods, phase)  \
+    static void __not_in_flash_func(name##_##indexed##lcd##dark)(const uint8_t *row, uint32_t *buff,      \
+                                                                  const uint16_t *pal)                      \
+    {                                                                                                     \
+        hstx_scale_row(row, buff, pal, indexed, lcd, dark, src_offset, src_period, dst_period, periods,   \
+                       phase);                                                                            \
+    }
+
+// HSTX_SCALER with an explicit sampling phase, see above.
+#define HSTX_SCALER_PHASED(name, src_offset, src_period, dst_period, periods, phase)                      \
+    HSTX_SCALER_ASSERT((dst_period) % 2 == 0, #name ": dst_period must be even");                         \
+    HSTX_SCALER_ASSERT((src_period) <= HSTX_SCALER_MAX_PERIOD, #name ": src_period too large");           \
+    HSTX_SCALER_ASSERT((dst_period) * (periods) <= HSTX_LINE_PIXELS, #name ": output too wide");      \
+    HSTX_SCALER_ASSERT((HSTX_LINE_PIXELS - (dst_period) * (periods)) % 4 == 0,                        \
+                       #name ": border is not a whole number of words");                                  \
+    HSTX_SCALER_ASSERT((src_offset) + (src_period) * (periods) <= HSTX_LINE_PIXELS / 2,               \
+                       #name ": crop exceeds the framebuffer row");                                       \
+    HSTX_SCALER_KERNEL(name, 0, 0, 0, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 0, 0, 1, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 0, 1, 0, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 0, 1, 1, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 1, 0, 0, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 1, 0, 1, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 1, 1, 0, src_offset, src_period, dst_period, periods, phase)                 \
+    HSTX_SCALER_KERNEL(name, 1, 1, 1, src_offset, src_period, dst_period, periods, phase)                 \
+    static const hstx_scaler_t name = {{{{name##_000, name##_001}, {name##_010, name##_011}},             \
+                                        {{name##_100, name##_101}, {name##_110, name##_111}}}}
+
+#define HSTX_SCALER(name, src_offset, src_period, dst_period, periods) \
+    HSTX_SCALER_PHASED(name, src_offset, src_period, dst_period, periods, src_period)
+#endif
@@ -13,7 +13,9 @@
 #include "hardware/structs/clocks.h"
 #include "hardware/structs/hstx_ctrl.h"
 #include "hardware/structs/hstx_fifo.h"
+#include "hardware/structs/m33.h"
 #include "hardware/structs/pll.h"
+#include "hardware/structs/xip_ctrl.h"
 
 #include <math.h>
 #include <string.h>
@@ -59,7 +61,6 @@
 #define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
 #define HSTX_CMD_NOP (0xfu << 12)
 
-#define SYNC_AFTER_DI (MODE_H_SYNC_WIDTH - W_PREAMBLE - W_DATA_ISLAND)
 
 // Video preamble and guard band widths (HDMI 1.3a Section 5.2.2)
 #define W_VIDEO_PREAMBLE 8
@@ -73,10 +74,47 @@ uint16_t frame_width = 0;
 uint16_t frame_height = 0;
 volatile uint32_t video_frame_count = 0;
 
+static const video_timing_t video_timings[VIDEO_OUTPUT_MODE_COUNT] = {
+    [VIDEO_OUTPUT_MODE_640x480] = {16, 96, 48, 640, 10, 2, 33, 480, 1, 0},
+    [VIDEO_OUTPUT_MODE_1280x240] = {32, 192, 96, 1280, 4, 4, 14, 240, 1, 3},
+    [VIDEO_OUTPUT_MODE_640x480_50] = {16, 96, 48, 640, 58, 2, 90, 480, 0, 0},
+    [VIDEO_OUTPUT_MODE_1280x240_50] = {32, 192, 96, 1280, 30, 3, 42, 240, 0, 3},
+};
+static video_output_mode_t video_mode = VIDEO_OUTPUT_DEFAULT_MODE;
+static const video_timing_t *timing = &video_timings[VIDEO_OUTPUT_DEFAULT_MODE];
+static uint32_t v_total_lines; // VIDEO_TIMING_V_TOTAL(timing), read on every line
+// Mode switch requested by video_output_set_mode, -1 when none. Consumed in video_output_core1_run().
+static volatile int mode_requested = -1;
+
+// DMA IRQ time in the frame being scanned out, and per mode totals
+static uint32_t irq_frame_us = 0;
+static uint64_t irq_total_us[VIDEO_OUTPUT_MODE_COUNT];
+static video_output_irq_stats_t irq_stats[VIDEO_OUTPUT_MODE_COUNT];
+
 #if HSTX_DEBUG
 static volatile uint32_t irq_count = 0;
 #endif
 
+// Time core1 spent in the DMA IRQ and the background task, in microseconds.
+// Wraps; callers diff two reads (see video_output_get_core1_busy_us).
+static volatile uint32_t core1_busy_us = 0;
+
+#if VIDEO_OUTPUT_LINE_MONITOR
+// Line being measured: one IRQ on blanking lines, two on active lines
+static struct {
+    uint32_t start;   // cycle count at the first IRQ of the line
+    uint32_t cycles;  // IRQ time so far
+    uint32_t xip_acc; // XIP cache counters and prefetch stalls at the start
+    uint32_t xip_hit;
+    uint32_t stalls;
+} line_mon;
+static uint32_t line_period_cycles; // set by build_command_lists
+static video_output_line_stats_t line_stats;
+static video_output_late_line_t late_lines[VIDEO_OUTPUT_LATE_LINE_LOG];
+static uint32_t late_line_count; // ring index = count & (LOG - 1)
+static volatile bool line_stats_reset_requested = false;
+#endif
+
 // DVI mode: when true, disables all HDMI Data Islands (pure DVI output, no audio)
 // Some monitors have trouble syncing with HDMI Data Islands
 static bool dvi_mode = false; // Default to HDMI mode (full features with audio)
@@ -85,14 +123,21 @@ static bool dvi_mode = false; // Default to HDMI mode (full features with audio)
 // current active line, the scanline callback fills line_buffer[fill_idx] with
 // the next line's pixels. This removes the write/read race and lets us
 // reconfigure the DMA *before* calling the (slow) scanline callback.
-static uint16_t line_buffer[2][MODE_H_ACTIVE_PIXELS] __attribute__((aligned(4)));
+static uint16_t line_buffer[2][VIDEO_OUTPUT_MAX_H_ACTIVE_PIXELS] __attribute__((aligned(4)));
 static uint8_t line_buf_fill_idx = 0;  // buffer the callback writes into
 static uint8_t line_buf_dma_idx = 0;   // buffer the next pixel-data DMA reads
 static uint32_t v_scanline = 2;
 static bool vactive_cmdlist_posted = false;
 static bool dma_pong = false;
 
-static video_output_task_fn background_task = NULL;
+static video_output_audio_task_fn audio_task = NULL; // driver's audio hook, runs first
+static video_output_task_fn background_task = NULL; // the application's task
+
+// video_output_stop asks the core 1 loop to park between tasks so core 1 is
+// never reset halfway through one (e.g. between queueing an audio packet and
+// publishing the FIFO tail). Cleared by video_output_init.
+static volatile bool core1_park_requested = false;
+static volatile bool core1_parked = false;
 static video_output_scanline_cb_t scanline_callback = NULL;
 static video_output_vsync_cb_t vsync_callback = NULL;
 
@@ -107,38 +152,34 @@ static volatile int resync_count = 0;
 // Command Lists
 // ============================================================================
 
-// Pure DVI command lists (no Data Islands)
-static uint32_t vblank_line_vsync_off[] = {HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-                                           SYNC_V1_H1,
-                                           HSTX_CMD_NOP,
-                                           HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-                                           SYNC_V1_H0,
-                                           HSTX_CMD_NOP,
-                                           HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-                                           SYNC_V1_H1,
-                                           HSTX_CMD_NOP};
-
-static uint32_t vblank_line_vsync_on[] = {HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-                                          SYNC_V0_H1,
-                                          HSTX_CMD_NOP,
-                                          HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-                                          SYNC_V0_H0,
-                                          HSTX_CMD_NOP,
-                                          HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-                                          SYNC_V0_H1,
-                                          HSTX_CMD_NOP};
-
-// Active video line for DVI mode (no Data Island, just sync + pixels)
-static uint32_t vactive_line_dvi[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH, SYNC_V1_H1, HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,  SYNC_V1_H0, HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_BACK_PORCH,  SYNC_V1_H1, HSTX_CMD_TMDS | MODE_H_ACTIVE_PIXELS};
-
-static uint32_t vactive_di_ping[128], vactive_di_pong[128], vactive_di_null[128];
-static uint32_t vactive_di_len, vactive_di_null_len;
-
-static uint32_t vblank_di_ping[128], vblank_di_pong[128], vblank_di_null[128];
-static uint32_t vblank_di_len, vblank_di_null_len;
+// Pure DVI blanking line (no Data Islands), only used to restart the DMA
+// chain at the top of the frame. Built by build_command_lists().
+static uint32_t vblank_line_vsync_off[9];
+
+// Longest line command list: sync and video preamble commands plus an island
+// of HSTX_DI_MAX_PACKETS_PER_LINE packets
+#define LINE_CMDLIST_WORDS (24 + HSTX_DI_MAX_PACKETS_PER_LINE * W_DATA_PACKET)
+// First packet word in a list from build_line_with_packets: front porch and
+// preamble commands (3 words each), the island command and the guard band
+#define LINE_CMDLIST_PACKET_OFFSET (7 + W_GUARDBAND)
+
+// Audio line command list. The sync, preamble and guard band words only
+// depend on the mode and the island size, so the list is laid out once per
+// island size and a line only copies the packet words into it.
+typedef struct {
+    uint32_t words[LINE_CMDLIST_WORDS];
+    uint32_t len;
+    int packets; // island size the list is laid out for
+} line_cmdlist_t;
+
+// Ping/pong: the list for the next line must not be the one the DMA is reading
+static line_cmdlist_t vactive_di[2], vblank_di[2];
+static uint32_t vactive_di_null[128], vactive_di_null_len;
+static uint32_t vblank_di_null[128], vblank_di_null_len;
+
+// Audio packets per line: HSTX_DI_MAX_PACKETS_PER_LINE or what fits in the
+// horizontal sync pulse of the current mode, whichever is less
+static int di_packets_per_line = 1;
 
 // DVI-mode null-DI cmdlist for VSYNC-active blanking lines. The other
 // null-DI buffers above are pre-built with vsync=false; we need a vsync=true
@@ -213,14 +254,16 @@ static void __not_in_flash_func(hstx_resync)(void)
 
 // __not_in_flash_func: called from the scanline DMA IRQ; must not fetch from
 // flash while the QMI may be saturated (CHD decompress, PSRAM traffic).
-static uint32_t __not_in_flash_func(build_line_with_di)(uint32_t *buf, const uint32_t *di_words, bool vsync, bool active)
+// The packets share one data island: one pair of guard bands around all of them.
+static uint32_t __not_in_flash_func(build_line_with_packets)(uint32_t *buf, const uint32_t *const *packets, int count,
+                                                             bool vsync, bool active)
 {
     uint32_t *p = buf;
     uint32_t sync_h0 = vsync ? SYNC_V0_H0 : SYNC_V1_H0;
     uint32_t sync_h1 = vsync ? SYNC_V0_H1 : SYNC_V1_H1;
     uint32_t preamble = vsync ? PREAMBLE_V0_H0 : PREAMBLE_V1_H0;
 
-    *p++ = HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH;
+    *p++ = HSTX_CMD_RAW_REPEAT | timing->h_front_porch;
     *p++ = sync_h1;
     *p++ = HSTX_CMD_NOP;
 
@@ -228,12 +271,21 @@ static uint32_t __not_in_flash_func(build_line_with_di)(uint32_t *buf, const uin
     *p++ = preamble;
     *p++ = HSTX_CMD_NOP;
 
-    *p++ = HSTX_CMD_RAW | W_DATA_ISLAND;
-    for (int i = 0; i < W_DATA_ISLAND; i++)
-        *p++ = di_words[i];
+    uint32_t island_width = 2 * W_GUARDBAND + count * W_DATA_PACKET;
+    *p++ = HSTX_CMD_RAW | island_width;
+    *p++ = packets[0][0];
+    *p++ = packets[0][1];
+    for (int k = 0; k < count; k++) {
+        const uint32_t *w = packets[k] + W_GUARDBAND;
+        *p++ = k ? hstx_data_island_continue_word(w[0]) : w[0];
+        for (int i = 1; i < W_DATA_PACKET; i++)
+            *p++ = w[i];
+    }
+    *p++ = packets[count - 1][W_DATA_ISLAND - 2];
+    *p++ = packets[count - 1][W_DATA_ISLAND - 1];
     *p++ = HSTX_CMD_NOP;
 
-    *p++ = HSTX_CMD_RAW_REPEAT | SYNC_AFTER_DI;
+    *p++ = HSTX_CMD_RAW_REPEAT | (timing->h_sync_width - W_PREAMBLE - island_width);
     *p++ = sync_h0;
     *p++ = HSTX_CMD_NOP;
 
@@ -242,7 +294,7 @@ static uint32_t __not_in_flash_func(build_line_with_di)(uint32_t *buf, const uin
         uint32_t video_preamble = vsync ? VIDEO_PREAMBLE_V0_H1 : VIDEO_PREAMBLE_V1_H1;
 
         // Control period (back porch minus preamble and guard band)
-        *p++ = HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH - W_VIDEO_PREAMBLE - W_VIDEO_GUARD_BAND);
+        *p++ = HSTX_CMD_RAW_REPEAT | (timing->h_back_porch - W_VIDEO_PREAMBLE - W_VIDEO_GUARD_BAND);
         *p++ = sync_h1;
         *p++ = HSTX_CMD_NOP;
 
@@ -256,15 +308,41 @@ static uint32_t __not_in_flash_func(build_line_with_di)(uint32_t *buf, const uin
         *p++ = VIDEO_GUARD_BAND;
 
         // Active video pixels
-        *p++ = HSTX_CMD_TMDS | MODE_H_ACTIVE_PIXELS;
+        *p++ = HSTX_CMD_TMDS | timing->h_active_pixels;
     } else {
-        *p++ = HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS);
+        *p++ = HSTX_CMD_RAW_REPEAT | (timing->h_back_porch + timing->h_active_pixels);
         *p++ = sync_h1;
         *p++ = HSTX_CMD_NOP;
     }
     return (uint32_t)(p - buf);
 }
 
+static inline uint32_t __not_in_flash_func(build_line_with_di)(uint32_t *buf, const uint32_t *di_words, bool vsync, bool active)
+{
+    return build_line_with_packets(buf, &di_words, 1, vsync, active);
+}
+
+// Puts the packets into an audio line list and returns it. Only a change of
+// island size lays the list out again.
+static inline const uint32_t *__not_in_flash_func(patch_line)(line_cmdlist_t *l, const uint32_t *const *packets,
+                                                             int count, bool active)
+{
+    if (l->packets != count) {
+        l->len = build_line_with_packets(l->words, packets, count, false, active);
+        l->packets = count;
+        return l->words;
+    }
+    // Volatile stores: keep GCC from calling flash-resident memcpy
+    volatile uint32_t *p = l->words + LINE_CMDLIST_PACKET_OFFSET;
+    for (int k = 0; k < count; k++) {
+        const uint32_t *w = packets[k] + W_GUARDBAND;
+        *p++ = k ? hstx_data_island_continue_word(w[0]) : w[0];
+        for (int i = 1; i < W_DATA_PACKET; i++)
+            *p++ = w[i];
+    }
+    return l->words;
+}
+
 typedef struct {
     bool vsync_active;
     bool front_porch;
@@ -276,22 +354,100 @@ typedef struct {
 
 static inline void __not_in_flash_func(get_scanline_state)(uint32_t v_scanline, scanline_state_t *state)
 {
-    state->vsync_active = (v_scanline >= MODE_V_FRONT_PORCH && v_scanline < (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH));
-    state->front_porch = (v_scanline < MODE_V_FRONT_PORCH);
-    state->back_porch = (v_scanline >= MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH &&
-                         v_scanline < MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH);
+    const uint32_t sync_start = timing->v_front_porch;
+    const uint32_t sync_end = sync_start + timing->v_sync_width;
+    const uint32_t active_start = v_total_lines - timing->v_active_lines;
+    state->vsync_active = (v_scanline >= sync_start && v_scanline < sync_end);
+    state->front_porch = (v_scanline < sync_start);
+    state->back_porch = (v_scanline >= sync_end && v_scanline < active_start);
     state->active_video = (!state->vsync_active && !state->front_porch && !state->back_porch);
 
-    state->send_acr = (v_scanline >= (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH) &&
-                       v_scanline < (MODE_V_TOTAL_LINES - MODE_V_ACTIVE_LINES) && (v_scanline % 4 == 0));
+    state->send_acr = (v_scanline >= sync_end && v_scanline < active_start && (v_scanline % 4 == 0));
 
     if (state->active_video) {
-        state->active_line = v_scanline - (MODE_V_TOTAL_LINES - MODE_V_ACTIVE_LINES);
+        state->active_line = v_scanline - active_start;
     } else {
         state->active_line = 0;
     }
 }
 
+#if VIDEO_OUTPUT_LINE_MONITOR
+// Runs in the IRQ on a reset request: plain stores, a memset would be fetched from flash
+static void __not_in_flash_func(line_monitor_clear)(void)
+{
+    volatile uint32_t *p = (volatile uint32_t *)&line_stats;
+    for (uint32_t i = 0; i < sizeof(line_stats) / sizeof(uint32_t); i++)
+        p[i] = 0;
+    line_stats.line_period_cycles = line_period_cycles;
+    late_line_count = 0;
+}
+
+static inline void __not_in_flash_func(line_monitor_begin)(uint32_t now)
+{
+    line_mon.start = now;
+    line_mon.cycles = 0;
+    line_mon.xip_acc = xip_ctrl_hw->ctr_acc;
+    line_mon.xip_hit = xip_ctrl_hw->ctr_hit;
+    line_mon.stalls = hstx_getPrefetchStalls();
+}
+
+// Called after the last IRQ of a line. Only lines near the deadline read the
+// counters again.
+static inline void __not_in_flash_func(line_monitor_end)(uint32_t line)
+{
+    video_output_line_stats_t *st = &line_stats;
+    uint32_t cycles = line_mon.cycles;
+    st->lines++;
+    if (cycles > st->max_cycles) {
+        st->max_cycles = cycles;
+        st->worst_line = line;
+        st->worst_cycle = line_mon.start;
+    }
+    if (cycles <= line_period_cycles - (line_period_cycles >> 3))
+        return;
+    if (cycles <= line_period_cycles) {
+        st->near_misses++;
+        return;
+    }
+    video_output_late_cause_t cause;
+    uint32_t misses = (xip_ctrl_hw->ctr_acc - line_mon.xip_acc) - (xip_ctrl_hw->ctr_hit - line_mon.xip_hit);
+    if (hstx_getPrefetchStalls() != line_mon.stalls)
+        cause = VIDEO_OUTPUT_LATE_PSRAM;
+    else if (misses >= VIDEO_OUTPUT_LATE_XIP_MISSES)
+        cause = VIDEO_OUTPUT_LATE_FLASH;
+    else
+        cause = VIDEO_OUTPUT_LATE_OTHER;
+    st->late++;
+    st->late_by_cause[cause]++;
+    video_output_late_line_t *l = &late_lines[late_line_count++ & (VIDEO_OUTPUT_LATE_LINE_LOG - 1)];
+    l->cycle = line_mon.start;
+    l->cycles = cycles;
+    l->line = (uint16_t)line;
+    l->cause = (uint8_t)cause;
+}
+#endif
+
+// First vsync line: closes the IRQ time measurement of the previous frame
+static inline void __not_in_flash_func(video_output_frame_start)(void)
+{
+    video_output_irq_stats_t *st = &irq_stats[video_mode];
+    st->frames++;
+    st->last_us = irq_frame_us;
+    if (irq_frame_us > st->max_us)
+        st->max_us = irq_frame_us;
+    irq_total_us[video_mode] += irq_frame_us;
+    irq_frame_us = 0;
+#if VIDEO_OUTPUT_LINE_MONITOR
+    if (line_stats_reset_requested) {
+        line_stats_reset_requested = false;
+        line_monitor_clear();
+    }
+#endif
+    video_frame_count++;
+    if (vsync_callback)
+        vsync_callback();
+}
+
 static inline void __not_in_flash_func(video_output_handle_vsync)(dma_channel_hw_t *ch, uint32_t v_scanline)
 {
     if (dvi_mode) {
@@ -304,18 +460,14 @@ static inline void __not_in_flash_func(video_output_handle_vsync)(dma_channel_hw
         // caused frequent lock loss and watchdog resyncs.
         ch->read_addr = (uintptr_t)vblank_di_null_vsync_on;
         ch->transfer_count = vblank_di_null_vsync_on_len;
-        if (v_scanline == MODE_V_FRONT_PORCH) {
-            video_frame_count++;
-            if (vsync_callback)
-                vsync_callback();
+        if (v_scanline == timing->v_front_porch) {
+            video_output_frame_start();
         }
     } else {
-        if (v_scanline == MODE_V_FRONT_PORCH) {
+        if (v_scanline == timing->v_front_porch) {
             ch->read_addr = (uintptr_t)vblank_acr_vsync_on;
             ch->transfer_count = vblank_acr_vsync_on_len;
-            video_frame_count++;
-            if (vsync_callback)
-                vsync_callback();
+            video_output_frame_start();
         } else {
             ch->read_addr = (uintptr_t)vblank_infoframe_vsync_on;
             ch->transfer_count = vblank_infoframe_vsync_on_len;
@@ -337,12 +489,12 @@ static inline void __not_in_flash_func(video_output_handle_active_start)(dma_cha
         ch->read_addr = (uintptr_t)vactive_di_null;
         ch->transfer_count = vactive_di_null_len;
     } else {
-        uint32_t *buf = dma_pong ? vactive_di_ping : vactive_di_pong;
-        const uint32_t *di_words = hstx_di_queue_get_audio_packet();
-        if (di_words) {
-            vactive_di_len = build_line_with_di(buf, di_words, false, true);
-            ch->read_addr = (uintptr_t)buf;
-            ch->transfer_count = vactive_di_len;
+        const uint32_t *packets[HSTX_DI_MAX_PACKETS_PER_LINE];
+        int count = hstx_di_queue_get_audio_packets(packets, di_packets_per_line);
+        if (count) {
+            line_cmdlist_t *l = &vactive_di[dma_pong];
+            ch->read_addr = (uintptr_t)patch_line(l, packets, count, true);
+            ch->transfer_count = l->len;
         } else {
             ch->read_addr = (uintptr_t)vactive_di_null;
             ch->transfer_count = vactive_di_null_len;
@@ -363,9 +515,17 @@ static inline void __not_in_flash_func(video_output_handle_active_start)(dma_cha
     //    zero-length garbage.
     uint32_t *dst32 = (uint32_t *)line_buffer[fill_idx];
     if (scanline_callback) {
+#if VIDEO_OUTPUT_LINE_MONITOR
+        uint32_t cb_start = m33_hw->dwt_cyccnt;
         scanline_callback(v_scanline, active_line, dst32);
+        uint32_t cb_cycles = m33_hw->dwt_cyccnt - cb_start;
+        if (cb_cycles > line_stats.max_callback_cycles)
+            line_stats.max_callback_cycles = cb_cycles;
+#else
+        scanline_callback(v_scanline, active_line, dst32);
+#endif
     } else {
-        for (uint32_t i = 0; i < MODE_H_ACTIVE_PIXELS / 2; i++) {
+        for (uint32_t i = 0; i < timing->h_active_pixels / 2u; i++) {
             dst32[i] = 0;
         }
     }
@@ -390,12 +550,12 @@ static inline void __not_in_flash_func(video_output_handle_blanking)(dma_channel
             ch->read_addr = (uintptr_t)vblank_avi_infoframe;
             ch->transfer_count = vblank_avi_infoframe_len;
         } else {
-            const uint32_t *di_words = hstx_di_queue_get_audio_packet();
-            if (di_words) {
-                uint32_t *buf = dma_pong ? vblank_di_ping : vblank_di_pong;
-                vblank_di_len = build_line_with_di(buf, di_words, false, false);
-                ch->read_addr = (uintptr_t)buf;
-                ch->transfer_count = vblank_di_len;
+            const uint32_t *packets[HSTX_DI_MAX_PACKETS_PER_LINE];
+            int count = hstx_di_queue_get_audio_packets(packets, di_packets_per_line);
+            if (count) {
+                line_cmdlist_t *l = &vblank_di[dma_pong];
+                ch->read_addr = (uintptr_t)patch_line(l, packets, count, false);
+                ch->transfer_count = l->len;
             } else {
                 ch->read_addr = (uintptr_t)vblank_di_null;
                 ch->transfer_count = vblank_di_null_len;
@@ -407,7 +567,7 @@ static inline void __not_in_flash_func(video_output_handle_blanking)(dma_channel
 static inline void __not_in_flash_func(video_output_handle_active_data)(dma_channel_hw_t *ch)
 {
     ch->read_addr = (uintptr_t)line_buffer[line_buf_dma_idx];
-    ch->transfer_count = (MODE_H_ACTIVE_PIXELS * sizeof(uint16_t)) / sizeof(uint32_t);
+    ch->transfer_count = (timing->h_active_pixels * sizeof(uint16_t)) / sizeof(uint32_t);
 }
 
 // ============================================================================
@@ -419,6 +579,12 @@ void __not_in_flash_func(dma_irq_handler)(void)
     #if HSTX_DEBUG
     irq_count++;
     #endif
+    uint32_t irq_start_us = time_us_32();
+#if VIDEO_OUTPUT_LINE_MONITOR
+    uint32_t irq_start_cycles = m33_hw->dwt_cyccnt;
+    if (!vactive_cmdlist_posted)
+        line_monitor_begin(irq_start_cycles);
+#endif
     uint32_t ch_num = dma_pong ? DMACH_PONG : DMACH_PING;
     dma_channel_hw_t *ch = &dma_hw->ch[ch_num];
     dma_hw->intr = 1U << ch_num;
@@ -440,11 +606,34 @@ void __not_in_flash_func(dma_irq_handler)(void)
     } else if (state.active_video && vactive_cmdlist_posted) {
         video_output_handle_active_data(ch);
         vactive_cmdlist_posted = false;
+#if HSTX_DI_QUEUE_COMPACT
+        // The pixel-data half of an active line has slack: encode the next
+        // audio packet here rather than on the line that sends it.
+        if (!dvi_mode)
+            hstx_di_queue_stage();
+#endif
     } else {
         video_output_handle_blanking(ch, v_scanline, state.send_acr, dma_pong);
+#if HSTX_DI_QUEUE_COMPACT
+        if (!dvi_mode)
+            hstx_di_queue_stage();
+#endif
     }
+#if VIDEO_OUTPUT_LINE_MONITOR
+    line_mon.cycles += m33_hw->dwt_cyccnt - irq_start_cycles;
+    if (!vactive_cmdlist_posted)
+        line_monitor_end(v_scanline);
+#endif
     if (!vactive_cmdlist_posted)
-        v_scanline = (v_scanline + 1) % MODE_V_TOTAL_LINES;
+        v_scanline = (v_scanline + 1) % v_total_lines;
+    uint32_t irq_us = time_us_32() - irq_start_us;
+    irq_frame_us += irq_us;
+    core1_busy_us += irq_us;
+}
+
+uint32_t __not_in_flash_func(video_output_get_core1_busy_us)(void)
+{
+    return core1_busy_us;
 }
 
 // ============================================================================
@@ -528,50 +717,87 @@ static void configure_audio_packets(uint32_t sample_rate)
     vblank_infoframe_vsync_off_len = build_line_with_di(vblank_infoframe_vsync_off, island.words, false, false);
 }
 
-void video_output_init(uint16_t width, uint16_t height)
+// (Re)builds every command list that depends on the video timing, for the
+// current mode. The DMA IRQ must not be running.
+static void build_command_lists(void)
 {
-    frame_width = width;
-    frame_height = height;
-
-    // Configure clk_hstx for the current video mode
-    // After set_sys_clock_khz(), clk_hstx needs to be reconfigured
-#ifndef NOHSTXCLOCK
-    uint32_t sys_freq = clock_get_hz(clk_sys);
-
-    clock_configure_int_divider(clk_hstx,
-                                0, // No glitchless mux
-                                CLOCKS_CLK_HSTX_CTRL_AUXSRC_VALUE_CLK_SYS, sys_freq, MODE_HSTX_CLK_DIV);
+    v_total_lines = VIDEO_TIMING_V_TOTAL(timing);
+    hstx_di_queue_set_line_rate(MODE_PIXEL_CLOCK_HZ / VIDEO_TIMING_H_TOTAL(timing));
+    // The island sits in the sync pulse after the preamble and leaves at
+    // least one pixel of it as control period
+    di_packets_per_line = (timing->h_sync_width - W_PREAMBLE - 2 * W_GUARDBAND - 1) / W_DATA_PACKET;
+    if (di_packets_per_line > HSTX_DI_MAX_PACKETS_PER_LINE)
+        di_packets_per_line = HSTX_DI_MAX_PACKETS_PER_LINE;
+#if VIDEO_OUTPUT_LINE_MONITOR
+    line_period_cycles =
+        (uint32_t)((uint64_t)clock_get_hz(clk_sys) * VIDEO_TIMING_H_TOTAL(timing) / MODE_PIXEL_CLOCK_HZ);
+    line_monitor_clear();
 #endif
-    // Claim DMA channels for HSTX (channels 0 and 1)
-    dma_channel_claim(DMACH_PING);
-    dma_channel_claim(DMACH_PONG);
 
-    // Initialize HDMI audio packets (default 48kHz)
-    configure_audio_packets(48000);
+    uint32_t *p = vblank_line_vsync_off;
+    *p++ = HSTX_CMD_RAW_REPEAT | timing->h_front_porch;
+    *p++ = SYNC_V1_H1;
+    *p++ = HSTX_CMD_NOP;
+    *p++ = HSTX_CMD_RAW_REPEAT | timing->h_sync_width;
+    *p++ = SYNC_V1_H0;
+    *p++ = HSTX_CMD_NOP;
+    *p++ = HSTX_CMD_RAW_REPEAT | (timing->h_back_porch + timing->h_active_pixels);
+    *p++ = SYNC_V1_H1;
+    *p++ = HSTX_CMD_NOP;
+
+    // ACR and Audio InfoFrame lines, keeping the configured audio rate
+    configure_audio_packets(configured_audio_sample_rate);
 
     hstx_packet_t packet;
     hstx_data_island_t island;
 
-#ifdef VIDEO_MODE_320x240
-    // PR=3 (4x repetition) for 1280x240 representing 320x240
-    hstx_packet_set_avi_infoframe(&packet, 1, 3);
-#else
-    hstx_packet_set_avi_infoframe(&packet, 1, 0);
-#endif
+    hstx_packet_set_avi_infoframe(&packet, timing->vic, timing->pixel_repetition);
     hstx_encode_data_island(&island, &packet, false, true);
     vblank_avi_infoframe_len = build_line_with_di(vblank_avi_infoframe, island.words, false, false);
 
     vblank_di_null_len = build_line_with_di(vblank_di_null, hstx_get_null_data_island(false, true), false, false);
     vactive_di_null_len = build_line_with_di(vactive_di_null, hstx_get_null_data_island(false, true), false, true);
 
-    // Vsync-active variant for DVI mode's two vsync lines (HDMI mode uses
+    // Vsync-active variant for DVI mode's vsync lines (HDMI mode uses
     // the ACR/InfoFrame cmdlists instead). Built with vsync=true so the sync
     // symbols carry VSYNC asserted, and the embedded null DI also has its
     // vsync-active TERC4 encoding.
     vblank_di_null_vsync_on_len = build_line_with_di(vblank_di_null_vsync_on, hstx_get_null_data_island(true, true), true, false);
 
-    vblank_di_len = build_line_with_di(vblank_di_ping, hstx_get_null_data_island(false, true), false, false);
-    memcpy(vblank_di_pong, vblank_di_ping, sizeof(vblank_di_ping));
+    // Audio line lists, laid out for single-packet islands
+    const uint32_t *null_island = hstx_get_null_data_island(false, true);
+    for (int i = 0; i < 2; i++) {
+        vactive_di[i].len = build_line_with_packets(vactive_di[i].words, &null_island, 1, false, true);
+        vactive_di[i].packets = 1;
+        vblank_di[i].len = build_line_with_packets(vblank_di[i].words, &null_island, 1, false, false);
+        vblank_di[i].packets = 1;
+    }
+}
+
+void video_output_init(uint16_t width, uint16_t height)
+{
+    frame_width = width;
+    frame_height = height;
+
+    // Configure clk_hstx for the current video mode
+    // After set_sys_clock_khz(), clk_hstx needs to be reconfigured
+#ifndef NOHSTXCLOCK
+    uint32_t sys_freq = clock_get_hz(clk_sys);
+
+    clock_configure_int_divider(clk_hstx,
+                                0, // No glitchless mux
+                                CLOCKS_CLK_HSTX_CTRL_AUXSRC_VALUE_CLK_SYS, sys_freq, MODE_HSTX_CLK_DIV);
+#endif
+    // Claim DMA channels for HSTX (channels 0 and 1)
+    dma_channel_claim(DMACH_PING);
+    dma_channel_claim(DMACH_PONG);
+
+    // Initialize HDMI audio packets (default 48kHz), then everything else
+    // for the current mode
+    configured_audio_sample_rate = 48000;
+    build_command_lists();
+    core1_parked = false;
+    core1_park_requested = false;
 }
 
 // Tear-down counterpart to video_output_init / video_output_core1_run.
@@ -581,11 +807,19 @@ void video_output_init(uint16_t width, uint16_t height)
 // dma_channel_claim and irq_set_exclusive_handler both panic on the second
 // install if the previous claim / handler wasn't released.
 //
-// Call ordering: caller must already have stopped feeding the audio path
-// (background_task = NULL) and be on core0 — core1 will be reset by the
-// caller after this returns.
+// Call ordering: must be called on core0, core1 will be reset by the caller
+// after this returns. The core1 loop is parked first, so the audio hook and
+// background task are never cut off mid-run; the caller should also clear
+// its audio hook so nothing is fed into the path being torn down.
 void video_output_stop(void)
 {
+    // Let core1 finish whatever task it is running. The timeout only matters
+    // if core1 is already wedged, in which case the reset is all that is left.
+    core1_park_requested = true;
+    uint32_t park_start_us = time_us_32();
+    while (!core1_parked && time_us_32() - park_start_us < 100000u)
+        tight_loop_contents();
+
     // Quiet the IRQ first so the DMA abort that follows can't trigger a
     // half-state in dma_irq_handler.
     irq_set_enabled(DMA_IRQ_0, false);
@@ -613,6 +847,11 @@ void video_output_stop(void)
     resync_requested = false;
 }
 
+void video_output_set_audio_task(video_output_audio_task_fn task)
+{
+    audio_task = task;
+}
+
 void video_output_set_background_task(video_output_task_fn task)
 {
     background_task = task;
@@ -682,6 +921,11 @@ void __not_in_flash_func(video_output_core1_run)(void)
         1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
         0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
 
+#endif
+#if VIDEO_OUTPUT_LINE_MONITOR
+    // The line monitor times the IRQ with this core's DWT cycle counter
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
 #endif
     hstx_ctrl_hw->csr = 0;
     hstx_ctrl_hw->csr = HSTX_CTRL_CSR_EXPAND_EN_BITS | (uint32_t)MODE_HSTX_CSR_CLKDIV << HSTX_CTRL_CSR_CLKDIV_LSB |
@@ -902,8 +1146,59 @@ void __not_in_flash_func(video_output_core1_run)(void)
                    cause, (unsigned long)hstx_di_queue_get_level(), resync_count);
         }
 
-        if (background_task) {
-            background_task();
+        // Mode switch: rebuild the command lists with the IRQ masked, then
+        // restart the DMA chain at the top of the new frame like a resync.
+        int new_mode = mode_requested;
+        if (new_mode >= 0)
+        {
+            mode_requested = -1;
+            irq_set_enabled(DMA_IRQ_0, false);
+            video_mode = (video_output_mode_t)new_mode;
+            timing = &video_timings[new_mode];
+            irq_frame_us = 0;
+            build_command_lists();
+            hstx_resync();
+            irq_set_enabled(DMA_IRQ_0, true);
+            last_frame_us = time_us_32();
+            last_frame_count_seen = video_frame_count;
+            overrate_last_us = last_frame_us;
+            overrate_last_frames = video_frame_count;
+        }
+
+        if (core1_park_requested) {
+            // video_output_stop is tearing down; idle here until core1 is reset
+            core1_parked = true;
+            while (1)
+                tight_loop_contents();
+        }
+
+        // The audio hook runs ahead of the application's task so a slow
+        // background task cannot starve the HDMI audio packet queue.
+        if (audio_task || background_task) {
+            // The DMA IRQ preempts the tasks and counts its own time, so only
+            // the wall time left after taking out the IRQ's share is added.
+            // The start is read again until no IRQ ran between the two reads;
+            // the update runs with the IRQ masked. Spins where the audio hook
+            // found nothing to do and there is no background task are idle
+            // time and skip the update.
+            uint32_t task_start_us, busy_start_us;
+            do {
+                busy_start_us = core1_busy_us;
+                task_start_us = time_us_32();
+            } while (busy_start_us != core1_busy_us);
+            bool worked = audio_task && audio_task();
+            if (background_task) {
+                background_task();
+                worked = true;
+            }
+            if (worked) {
+                uint32_t irq_state = save_and_disable_interrupts();
+                uint32_t task_us = time_us_32() - task_start_us;
+                uint32_t irq_us = core1_busy_us - busy_start_us;
+                if (task_us > irq_us)
+                    core1_busy_us += task_us - irq_us;
+                restore_interrupts(irq_state);
+            }
         }
         tight_loop_contents();
     }
@@ -924,4 +1219,70 @@ int get_video_output_resync_count(void)
     return resync_count;
 }
 
+void video_output_set_mode(video_output_mode_t mode)
+{
+    if ((unsigned)mode < VIDEO_OUTPUT_MODE_COUNT && (mode != video_mode || mode_requested >= 0))
+        mode_requested = mode;
+}
+
+video_output_mode_t video_output_get_mode(void)
+{
+    return video_mode;
+}
+
+video_output_mode_t video_output_get_requested_mode(void)
+{
+    int requested = mode_requested;
+    return requested >= 0 ? (video_output_mode_t)requested : video_mode;
+}
+
+const video_timing_t *__not_in_flash_func(video_output_get_timing)(void)
+{
+    return timing;
+}
+
+void video_output_get_irq_stats(video_output_mode_t mode, video_output_irq_stats_t *stats)
+{
+    if ((unsigned)mode >= VIDEO_OUTPUT_MODE_COUNT) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    // Updated by core 1 once per frame; a torn read is off by one frame at most
+    *stats = irq_stats[mode];
+    stats->avg_us = stats->frames ? (uint32_t)(irq_total_us[mode] / stats->frames) : 0;
+}
 
+void video_output_get_line_stats(video_output_line_stats_t *stats)
+{
+#if VIDEO_OUTPUT_LINE_MONITOR
+    // Written by core 1 on every line; fields may be a line apart
+    *stats = line_stats;
+    stats->min_slack_cycles = (int32_t)(stats->line_period_cycles - stats->max_cycles);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+int video_output_get_late_lines(video_output_late_line_t *lines, int max)
+{
+#if VIDEO_OUTPUT_LINE_MONITOR
+    uint32_t count = late_line_count;
+    int n = 0;
+    while (n < max && (uint32_t)n < count && n < VIDEO_OUTPUT_LATE_LINE_LOG) {
+        lines[n] = late_lines[(count - 1 - n) & (VIDEO_OUTPUT_LATE_LINE_LOG - 1)];
+        n++;
+    }
+    return n;
+#else
+    (void)lines;
+    (void)max;
+    return 0;
+#endif
+}
+
+void video_output_reset_line_stats(void)
+{
+#if VIDEO_OUTPUT_LINE_MONITOR
+    line_stats_reset_requested = true;
+#endif
+}
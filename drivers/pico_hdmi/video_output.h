@@ -8,47 +8,83 @@
 // Video Output Configuration
 // ============================================================================
 
-// Video mode selection (define VIDEO_MODE_320x240 before including this header)
+// Both modes run at the same 25.2 MHz pixel clock, so the HSTX clock and the
+// HDMI audio clock regeneration (ACR) values do not depend on the mode:
+//
+// 640x480 @ 60Hz (VIC 1): H 16/96/48/640, V 10/2/33/480, 525 lines.
+//   Each framebuffer row is output on two lines.
+// 1280x240 @ 60Hz, true 240p at quad clock rate: H 32/192/96/1280
+//   (8/48/24/320 x 4), V 4/4/14/240, 262 lines, pixels sent 4 times (AVI
+//   pixel repetition 3). One line per framebuffer row, so the DMA IRQ and the
+//   scanline callback run half as often.
+//
+// The _50 variants have the same lines with a longer vertical blank, exactly
+// 50 Hz for PAL content: 640x480 with 630 lines (V 58/2/90/480) and 1280x240
+// with 315 lines (V 30/3/42/240). There is no CEA code for these, so the AVI
+// InfoFrame sends VIC 0. The pixel clock and so the ACR values stay the same.
+//
+// The mode is switched at runtime with video_output_set_mode(). Define
+// VIDEO_MODE_320x240 to start in 240p.
+typedef enum {
+    VIDEO_OUTPUT_MODE_640x480,
+    VIDEO_OUTPUT_MODE_1280x240,
+    VIDEO_OUTPUT_MODE_640x480_50,
+    VIDEO_OUTPUT_MODE_1280x240_50,
+    VIDEO_OUTPUT_MODE_COUNT
+} video_output_mode_t;
+
 #ifdef VIDEO_MODE_320x240
+#define VIDEO_OUTPUT_DEFAULT_MODE VIDEO_OUTPUT_MODE_1280x240
+#else
+#define VIDEO_OUTPUT_DEFAULT_MODE VIDEO_OUTPUT_MODE_640x480
+#endif
 
-// 1280x240 @ 60Hz - True 240p (Quad Clock Rate)
-// Pixel Clock: 25.2 MHz (15kHz scan rate)
-// H_TOTAL = 1600 pixels, V_TOTAL = 262 lines
-// Active: 1280 (320x4), Front: 32 (8x4), Sync: 192 (48x4), Back: 96 (24x4)
+typedef struct {
+    uint16_t h_front_porch;
+    uint16_t h_sync_width;
+    uint16_t h_back_porch;
+    uint16_t h_active_pixels;
+    uint16_t v_front_porch;
+    uint16_t v_sync_width;
+    uint16_t v_back_porch;
+    uint16_t v_active_lines;
+    uint8_t vic;              // AVI InfoFrame video identification code
+    uint8_t pixel_repetition; // AVI InfoFrame PR field, pixels are sent PR + 1 times
+} video_timing_t;
+
+#define VIDEO_TIMING_H_TOTAL(t) ((t)->h_front_porch + (t)->h_sync_width + (t)->h_back_porch + (t)->h_active_pixels)
+#define VIDEO_TIMING_V_TOTAL(t) ((t)->v_front_porch + (t)->v_sync_width + (t)->v_back_porch + (t)->v_active_lines)
+// Widest active line of all modes, sizes the line buffers
+#define VIDEO_OUTPUT_MAX_H_ACTIVE_PIXELS 1280
+
+// HSTX clock divider: clk_sys / 1 = 126 MHz -> 25.2 MHz pixel clock (with CSR_CLKDIV=5)
+#define MODE_HSTX_CLK_DIV 1
+#define MODE_HSTX_CSR_CLKDIV 5
+// Pixel clock of all modes, the refresh rate is MODE_PIXEL_CLOCK_HZ / (H_TOTAL * V_TOTAL)
+#define MODE_PIXEL_CLOCK_HZ 25200000u
+
+// Deprecated: the timing of VIDEO_OUTPUT_DEFAULT_MODE, kept for code written
+// before runtime mode switching. They do not follow video_output_set_mode();
+// use video_output_get_timing() for the mode being output.
+#ifdef VIDEO_MODE_320x240
 #define MODE_H_FRONT_PORCH 32
 #define MODE_H_SYNC_WIDTH 192
 #define MODE_H_BACK_PORCH 96
 #define MODE_H_ACTIVE_PIXELS 1280
-
 #define MODE_V_FRONT_PORCH 4
 #define MODE_V_SYNC_WIDTH 4
 #define MODE_V_BACK_PORCH 14
 #define MODE_V_ACTIVE_LINES 240
-
-// HSTX clock divider: clk_sys / 1 = 126 MHz -> 25.2 MHz pixel clock (with CSR_CLKDIV=5)
-#define MODE_HSTX_CLK_DIV 1
-#define MODE_HSTX_CSR_CLKDIV 5
-
 #else
-
-// 640x480 @ 60Hz (VIC 1) - Default mode
-// Pixel clock: 25.2 MHz
 #define MODE_H_FRONT_PORCH 16
 #define MODE_H_SYNC_WIDTH 96
 #define MODE_H_BACK_PORCH 48
 #define MODE_H_ACTIVE_PIXELS 640
-
 #define MODE_V_FRONT_PORCH 10
 #define MODE_V_SYNC_WIDTH 2
 #define MODE_V_BACK_PORCH 33
 #define MODE_V_ACTIVE_LINES 480
-
-// HSTX clock divider: 1 (no division)
-#define MODE_HSTX_CLK_DIV 1
-#define MODE_HSTX_CSR_CLKDIV 5
-
 #endif
-
 #define MODE_H_TOTAL_PIXELS (MODE_H_FRONT_PORCH + MODE_H_SYNC_WIDTH + MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS)
 #define MODE_V_TOTAL_LINES (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH + MODE_V_ACTIVE_LINES)
 
@@ -67,17 +103,19 @@ extern volatile uint32_t video_frame_count;
 // ============================================================================
 
 typedef void (*video_output_task_fn)(void);
+// Returns true when it did work, so idle spins of the Core 1 loop stay cheap
+typedef bool (*video_output_audio_task_fn)(void);
 typedef void (*video_output_vsync_cb_t)(void);
 
 /**
  * Scanline Callback:
  * Called by the video output system when it needs pixel data for a scanline.
  *
- * @param v_scanline The current vertical scanline (0 to MODE_V_TOTAL_LINES - 1)
- * @param active_line The current active video line (0 to MODE_V_ACTIVE_LINES - 1),
+ * @param v_scanline The current vertical scanline (0 to V_TOTAL - 1 of the current mode)
+ * @param active_line The current active video line (0 to v_active_lines - 1),
  *                    only valid if active_video is true.
- * @param line_buffer Buffer to fill with MODE_H_ACTIVE_PIXELS RGB565 pixels (packed as uint32_t pairs).
- *                    The buffer MUST be filled with (MODE_H_ACTIVE_PIXELS / 2) uint32_t words.
+ * @param line_buffer Buffer to fill with h_active_pixels RGB565 pixels (packed as uint32_t pairs).
+ *                    The buffer MUST be filled with (h_active_pixels / 2) uint32_t words.
  *                    - 640x480 mode: 640 pixels = 320 uint32_t words
  *                    - 320x240 mode: 1280 pixels = 640 uint32_t words (4x pixel repetition)
  */
@@ -93,8 +131,9 @@ void video_output_init(uint16_t width, uint16_t height);
 /**
  * Tear down the HSTX video output. Disables and unclaims the DMA channels
  * + IRQ that video_output_init / video_output_core1_run installed so a
- * subsequent re-init can reclaim them. Must be called from core0 only,
- * after core1's loop has been stopped or is about to be reset.
+ * subsequent re-init can reclaim them. Must be called from core0 only, with
+ * core1 about to be reset: core1's loop is first parked between tasks so
+ * neither task is interrupted halfway.
  */
 void video_output_stop(void);
 
@@ -109,8 +148,14 @@ void video_output_set_scanline_callback(video_output_scanline_cb_t cb);
 void video_output_set_vsync_callback(video_output_vsync_cb_t cb);
 
 /**
- * Register a background task to run in the Core 1 loop.
- * This is typically used for audio processing.
+ * Register the audio hook run in the Core 1 loop, ahead of the background
+ * task. Reserved for the driver's HDMI audio path (hstx.c); NULL removes it.
+ */
+void video_output_set_audio_task(video_output_audio_task_fn task);
+
+/**
+ * Register a background task to run in the Core 1 loop, after the audio hook.
+ * Free for the application; the driver does not use it.
  */
 void video_output_set_background_task(video_output_task_fn task);
 
@@ -156,4 +201,91 @@ void video_output_request_resync(void);
 
 int get_video_output_resync_count(void);
 
+/**
+ * Switch the video timing. The request is latched and applied by the core-1
+ * main loop: the command lists, AVI InfoFrame and audio packet schedule are
+ * rebuilt for the new mode and the output restarts through the same path as
+ * a resync. Safe to call from core 0 at any time; the sink may take a moment
+ * to lock to the new timing.
+ */
+void video_output_set_mode(video_output_mode_t mode);
+video_output_mode_t video_output_get_mode(void);
+/// Mode the output is switching to, or the current mode when no switch is
+/// pending; base a new request on this one so a pending request is not lost.
+video_output_mode_t video_output_get_requested_mode(void);
+/// Timing of the current mode
+const video_timing_t *video_output_get_timing(void);
+
+/**
+ * Time the DMA IRQ (including the scanline callback) takes per frame in each
+ * mode, measured from one vsync to the next.
+ */
+typedef struct {
+    uint32_t frames;    // frames measured in this mode
+    uint32_t avg_us;    // average IRQ time per frame
+    uint32_t max_us;    // worst frame
+    uint32_t last_us;   // most recent frame
+} video_output_irq_stats_t;
+void video_output_get_irq_stats(video_output_mode_t mode, video_output_irq_stats_t *stats);
+
+/**
+ * Time core 1 spent in the video DMA IRQ and the background task since boot,
+ * in microseconds. Wraps every ~71 minutes; diff two reads to get the busy
+ * time over an interval, the rest of core 1 is spent in its idle loop.
+ */
+uint32_t video_output_get_core1_busy_us(void);
+
+/**
+ * Line-deadline monitor. Every line the DMA IRQ (including the scanline
+ * callback) is timed with core 1's cycle counter and compared to the line
+ * period: the IRQ that arms a line's command list must be done before the
+ * other channel finishes the line in flight, or HSTX runs dry. Lines that
+ * take longer are counted as late and blamed on the first cause that applies:
+ * the framebuffer row prefetch stalled on PSRAM, the XIP cache refilled at
+ * least VIDEO_OUTPUT_LATE_XIP_MISSES times (flash fetches by either core
+ * competing for the QMI), or neither. It costs a few register reads per line;
+ * build with VIDEO_OUTPUT_LINE_MONITOR=0 to remove it.
+ */
+#ifndef VIDEO_OUTPUT_LINE_MONITOR
+#define VIDEO_OUTPUT_LINE_MONITOR 1
+#endif
+#ifndef VIDEO_OUTPUT_LATE_XIP_MISSES
+#define VIDEO_OUTPUT_LATE_XIP_MISSES 32
+#endif
+// Late lines kept with their timestamps, power of two
+#define VIDEO_OUTPUT_LATE_LINE_LOG 8
+
+typedef enum {
+    VIDEO_OUTPUT_LATE_PSRAM, // framebuffer prefetch stalled
+    VIDEO_OUTPUT_LATE_FLASH, // XIP cache refills during the line
+    VIDEO_OUTPUT_LATE_OTHER, // the handler itself
+} video_output_late_cause_t;
+
+typedef struct {
+    uint32_t lines;               // lines measured since the last reset
+    uint32_t line_period_cycles;  // the deadline, one line in clk_sys cycles
+    uint32_t max_cycles;          // longest IRQ time spent on one line
+    int32_t min_slack_cycles;     // line period minus max_cycles, negative when late
+    uint32_t max_callback_cycles; // longest scanline callback
+    uint32_t worst_line;          // scanline that took max_cycles
+    uint32_t worst_cycle;         // cycle count when that line started
+    uint32_t near_misses;         // lines within 1/8 of the line period, not late
+    uint32_t late;                // lines over the line period
+    uint32_t late_by_cause[3];    // indexed by video_output_late_cause_t
+} video_output_line_stats_t;
+
+typedef struct {
+    uint32_t cycle;  // core 1 cycle count when the line started
+    uint32_t cycles; // IRQ time spent on the line
+    uint16_t line;   // scanline
+    uint8_t cause;   // video_output_late_cause_t
+} video_output_late_line_t;
+
+/// All zero when the monitor is compiled out.
+void video_output_get_line_stats(video_output_line_stats_t *stats);
+/// Copies up to max of the most recent late lines, newest first, returns the count.
+int video_output_get_late_lines(video_output_late_line_t *lines, int max);
+/// Clears the statistics at the next vsync. A mode switch clears them as well.
+void video_output_reset_line_stats(void);
+
 #endif // VIDEO_OUTPUT_H
@@ -13,6 +13,9 @@
 #include "FrensFonts.h"
 #include "gamepad.h"
 #include "RomLister.h"
+#include "MetadataDb.h"
+#include "ScanlineCompositor.h"
+#include "IdleTasks.h"
 #include "menu.h"
 #include "nespad.h"
 #include "wiipad.h"
@@ -106,6 +109,11 @@ static char valueBuf[16]; // separate buffer for numeric values
 static bool exitMenu = false;
 static bool settingsActive = false;
 static WORD *WorkLineRom = nullptr;
+#if !HSTX
+typedef dvi::DVI::LineBuffer *MenuLineBuffer;
+#else
+typedef void *MenuLineBuffer;
+#endif
 
 #if PICO_RP2350
 // Track current WAV playback path and state while in the menu
@@ -240,6 +248,20 @@ int Menu_LoadFrame()
         hstx_getframecounter();
 #endif
     Frens::pollHeadPhoneJack();
+#if MENU_IDLE_DEBUG
+    // Report how much of core0 the menu leaves idle, every ten seconds
+    static uint32_t lastIdleReport = 0;
+    if (count - lastIdleReport >= 600)
+    {
+        lastIdleReport = count;
+        int idle = Frens::getIdlePermille();
+        if (idle >= 0)
+        {
+            printf("Menu idle: %d.%d%%\n", idle / 10, idle % 10);
+        }
+        Frens::printIdleTaskStats();
+    }
+#endif
     auto onOff = hw_divider_s32_quotient_inlined(count, 60) & 1;
     Frens::blinkLed(onOff);
 #if NES_PIN_CLK != -1
@@ -415,6 +437,43 @@ void RomSelect_DrawLine(int line, int selectedRow, int pixelsToSkip = 0)
     return;
 }
 
+// Points WorkLineRom at a scanline's framebuffer line or a free DVI line buffer (see submitMenuLine).
+static inline void acquireMenuLine(int scanline, MenuLineBuffer &b)
+{
+#if !HSTX
+    b = nullptr;
+#if FRAMEBUFFERISPOSSIBLE
+    if (Frens::isFrameBufferUsed())
+    {
+        WorkLineRom = &Frens::framebuffer[scanline * SCREENWIDTH];
+    }
+    else
+    {
+#endif
+        b = dvi_->getLineBuffer();
+        WorkLineRom = b->data();
+#if FRAMEBUFFERISPOSSIBLE
+    }
+#endif
+#else
+    WorkLineRom = hstx_getlineFromFramebuffer(scanline);
+#endif // !HSTX
+}
+
+static inline void submitMenuLine(int scanline, MenuLineBuffer b)
+{
+#if !HSTX
+#if FRAMEBUFFERISPOSSIBLE
+    if (!Frens::isFrameBufferUsed())
+    {
+#endif
+        dvi_->setLineBuffer(scanline, b);
+#if FRAMEBUFFERISPOSSIBLE
+    }
+#endif
+#endif
+}
+
 /// @brief Renders a single 320-pixel scanline into the active video line buffer.
 ///        Optionally blends (actually overwrites) an image row before drawing text.
 ///        Text glyphs are only drawn when not in screensaver (image moving) mode.
@@ -449,24 +508,8 @@ void RomSelect_DrawLine(int line, int selectedRow, int pixelsToSkip = 0)
 ///   - scanline outside imagey..imagey+h: only text (unless reserved offset for early lines).
 void drawline(int scanline, int selectedRow, int w = 0, int h = 0, uint16_t *imagebuffer = nullptr, int imagex = 0, int imagey = 0)
 {
-#if !HSTX
-    dvi::DVI::LineBuffer *b = nullptr;
-#if FRAMEBUFFERISPOSSIBLE
-    if (Frens::isFrameBufferUsed())
-    {
-        WorkLineRom = &Frens::framebuffer[scanline * SCREENWIDTH];
-    }
-    else
-    {
-#endif
-        b = dvi_->getLineBuffer();
-        WorkLineRom = b->data();
-#if FRAMEBUFFERISPOSSIBLE
-    }
-#endif
-#else
-    WorkLineRom = hstx_getlineFromFramebuffer(scanline);
-#endif // !HSTX
+    MenuLineBuffer b;
+    acquireMenuLine(scanline, b);
 
     auto offset = 0;
     bool validImage = (imagebuffer != nullptr) && (w > 0 && w <= SCREENWIDTH && h > 0 && h <= SCREENHEIGHT);
@@ -500,17 +543,28 @@ void drawline(int scanline, int selectedRow, int w = 0, int h = 0, uint16_t *ima
     {
         RomSelect_DrawLine(scanline, selectedRow, offset);
     }
+    submitMenuLine(scanline, b);
+}
 
-#if !HSTX
-#if FRAMEBUFFERISPOSSIBLE
-    if (!Frens::isFrameBufferUsed())
-    {
+/// @brief Renders a frame through the scanline compositor.
+/// Framebuffer targets keep their contents, so only the spans the compositor reports
+/// as changed are written; DVI line buffers are always composed and submitted in full.
+void DrawLayers(Frens::ScanlineCompositor &compositor)
+{
+#if HSTX
+    bool persistentTarget = true;
+#else
+    bool persistentTarget = Frens::isFrameBufferUsed();
 #endif
-        dvi_->setLineBuffer(scanline, b);
-#if FRAMEBUFFERISPOSSIBLE
+    compositor.beginFrame(persistentTarget);
+    for (auto line = 0; line < SCREENHEIGHT; line++)
+    {
+        MenuLineBuffer b;
+        acquireMenuLine(line, b);
+        compositor.composeLine(line, WorkLineRom);
+        submitMenuLine(line, b);
     }
-#endif
-#endif
+    compositor.endFrame();
 }
 
 void putText(int x, int y, const char *text, int fgcolor, int bgcolor, bool wraplines, int offset)
@@ -1389,6 +1443,11 @@ void screenSaverWithArt(bool showdefault = false)
     uint16_t *imagebuffer = nullptr;
     int imagex = 0;
     int imagey = 0;
+    // The image is a sprite over a black background. Only the spans the image
+    // moved over are rewritten each frame when drawing into a framebuffer.
+    Frens::ScanlineCompositor compositor(SCREENWIDTH, SCREENHEIGHT);
+    compositor.setBackground(nullptr, 0);
+    int sprite = -1;
     PATH = (char *)Frens::f_malloc(FF_MAX_LFN + 1);
     CHOSEN = (char *)Frens::f_malloc(FF_MAX_LFN + 1);
     // set speed
@@ -1416,7 +1475,7 @@ void screenSaverWithArt(bool showdefault = false)
             {
                 fld = (char)(rand() % 15);
                 snprintf(PATH, (FF_MAX_LFN + 1) * sizeof(char), "/metadata/%s/images/160/%X", FrensSettings::getEmulatorTypeString(), fld);
-                printf("Scanning random folder: %s\n", PATH);
+                printf("Picking from random folder: %s\n", PATH);
                 fr = Frens::pick_random_file_fullpath(PATH, CHOSEN, (FF_MAX_LFN + 1) * sizeof(char));
             }
             else
@@ -1467,6 +1526,7 @@ void screenSaverWithArt(bool showdefault = false)
                 PATH = nullptr;
                 Frens::f_free(CHOSEN);
                 CHOSEN = nullptr;
+                Frens::freeRandomFileCache();
                 return; // avoid endless loop of invalid images
             }
             imagebuffer = buffer ? (uint16_t *)(buffer + 4) : nullptr;
@@ -1477,10 +1537,23 @@ void screenSaverWithArt(bool showdefault = false)
                 imagey = rand() % (SCREENHEIGHT - height + 1);
             }
             first = false;
+            if (sprite < 0)
+            {
+                sprite = compositor.addSprite(imagebuffer, width, height, imagex, imagey);
+            }
+            else
+            {
+                compositor.setSpriteImage(sprite, imagebuffer, width, height);
+            }
         }
         Menu_LoadFrame();
         frameCount++;
-        DrawScreen(-1, width, height, imagebuffer, imagex, imagey);
+        // No sprite when the compositor is full; the background is still drawn
+        if (sprite >= 0)
+        {
+            compositor.moveSprite(sprite, imagex, imagey);
+        }
+        DrawLayers(compositor);
         RomSelect_PadState(&PAD1_Latch);
         if (PAD1_Latch > 0)
         {
@@ -1493,6 +1566,8 @@ void screenSaverWithArt(bool showdefault = false)
                 Frens::f_free(CHOSEN);
                 CHOSEN = nullptr;
             }
+            // Release the per-folder file lists used to pick the images
+            Frens::freeRandomFileCache();
             srand(get_rand_32()); // Seed the random number generator for screensaver
             return;
         }
@@ -1611,29 +1686,39 @@ int showartwork(uint32_t crc, FSIZE_t romsize)
     uint16_t *imagebuffer = buffer ? (uint16_t *)(buffer + 4) : nullptr;
     printf("Image size: %d x %d pixels\n", width, height);
 
-    // open the file with metadata info
-    snprintf(PATH, (FF_MAX_LFN + 1) * sizeof(char), METADDATAFILE, FrensSettings::getEmulatorTypeString(), CRC[0], CRC);
-    fr = f_open(&fil, PATH, FA_READ);
-    if (fr == FR_OK)
+    // Look up the metadata in the packed database first, fall back to the loose file per game.
+    // A database record is freed the same way as the loose file buffer.
+    metadatabuffer = MetadataDb::lookup(FrensSettings::getEmulatorTypeString(), crc);
+    bool metadataFromDb = metadatabuffer != nullptr;
+    if (!metadataFromDb)
     {
-        auto fsize = f_size(&fil);
-        printf("Reading %s, size: %d bytes\n", PATH, fsize);
-        metadatabuffer = (char *)Frens::f_malloc(fsize + 1);
-        size_t r;
-        fr = f_read(&fil, metadatabuffer, fsize, &r);
-        if (fr != FR_OK || r != fsize)
+        // open the file with metadata info
+        snprintf(PATH, (FF_MAX_LFN + 1) * sizeof(char), METADDATAFILE, FrensSettings::getEmulatorTypeString(), CRC[0], CRC);
+        fr = f_open(&fil, PATH, FA_READ);
+        if (fr == FR_OK)
         {
-            printf("Error reading %s: %d, read %d bytes\n", PATH, fr, r);
-            Frens::f_free(metadatabuffer);
+            auto fsize = f_size(&fil);
+            printf("Reading %s, size: %d bytes\n", PATH, fsize);
+            metadatabuffer = (char *)Frens::f_malloc(fsize + 1);
+            size_t r;
+            fr = f_read(&fil, metadatabuffer, fsize, &r);
+            if (fr != FR_OK || r != fsize)
+            {
+                printf("Error reading %s: %d, read %d bytes\n", PATH, fr, r);
+                Frens::f_free(metadatabuffer);
+                metadatabuffer = nullptr;
+            }
+            else
+            {
+                metadatabuffer[fsize] = '\0';
+            }
+            f_close(&fil);
+        }
+        else
+        {
+            printf("Error opening %s: %d\n", PATH, fr);
             metadatabuffer = nullptr;
         }
-        metadatabuffer[fsize] = '\0';
-        f_close(&fil);
-    }
-    else
-    {
-        printf("Error opening %s: %d\n", PATH, fr);
-        metadatabuffer = nullptr;
     }
     if (!metadatabuffer && !buffer)
     {
@@ -1650,7 +1735,17 @@ int showartwork(uint32_t crc, FSIZE_t romsize)
     }
     gamename[0] = desc[0] = releaseDate[0] = developer[0] = genre[0] = rating[0] = players[0] = '\0';
     // extract the tags:
-    if (metadatabuffer)
+    if (metadataFromDb)
+    {
+        MetadataDb::copyField(metadatabuffer, MetadataDb::NAME, gamename, sizeof(gamename));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::RELEASEDATE, releaseDate, sizeof(releaseDate));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::DEVELOPER, developer, sizeof(developer));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::GENRE, genre, sizeof(genre));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::DESC, desc, DESC_SIZE * sizeof(char));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::RATING, rating, sizeof(rating));
+        MetadataDb::copyField(metadatabuffer, MetadataDb::PLAYERS, players, sizeof(players));
+    }
+    else if (metadatabuffer)
     {
         Frens::get_tag_text(metadatabuffer, "name", gamename, sizeof(gamename));
         Frens::get_tag_text(metadatabuffer, "releasedate", releaseDate, sizeof(releaseDate));
@@ -1668,6 +1763,9 @@ int showartwork(uint32_t crc, FSIZE_t romsize)
         printf("Players: %s\n", players);
         printf("Description: %s\n", desc);
 #endif
+    }
+    if (metadatabuffer)
+    {
         stars = (int)(rating[0] - '0') * 10 + (int)(rating[2] - '0'); // convert first character to int
         if (stars < 0 || stars > 10)
         {
@@ -2560,6 +2658,9 @@ int showSettingsMenu(bool calledFromGame)
     int rval = 0;
     int margintop = 0;
     int marginbottom = 0;
+#if HSTX
+    hstx_fb_format_t fbFormat = hstx_getFramebufferFormat();
+#endif
     settingsActive = true;
     // Re-seed the FDS preview from the live current side on every menu
     // open. The render switch fills it in on first draw.
@@ -2610,6 +2711,9 @@ int showSettingsMenu(bool calledFromGame)
         printf("Top margin: %d, bottom margin: %d\n", margintop, marginbottom);
         dvi_->getBlankSettings().top = 0;
         dvi_->getBlankSettings().bottom = 0;
+#else
+        hstx_setSwapchainPaused(true);
+        hstx_setFramebufferFormat(HSTX_FB_RGB555);
 #endif
         scaleMode8_7_ = Frens::applyScreenMode(ScreenMode::NOSCANLINE_1_1);
     }
@@ -3674,6 +3778,10 @@ int showSettingsMenu(bool calledFromGame)
             dvi_->getBlankSettings().top = margintop;
             dvi_->getBlankSettings().bottom = marginbottom;
         }
+#else
+        // Back to the game's format; its next frame redraws the framebuffer
+        hstx_setFramebufferFormat(fbFormat);
+        hstx_setSwapchainPaused(false);
 #endif
         // Speaker can be muted/unmuted from settings menu
         //EXT_AUDIO_MUTE_INTERNAL_SPEAKER(settings.flags.fruitJamEnableInternalSpeaker == 0);
@@ -3720,6 +3828,11 @@ void menu(const char *title, char *errorMessage, bool isFatal, bool showSplash,
     printf("Top margin: %d, bottom margin: %d\n", margintop, marginbottom);
     dvi_->getBlankSettings().top = 0;
     dvi_->getBlankSettings().bottom = 0;
+#else
+    // The menu draws RGB555 into the built-in framebuffer; an emulator may
+    // have left it indexed or page flipping
+    hstx_swapchainInit(nullptr, 1);
+    hstx_setFramebufferFormat(HSTX_FB_RGB555);
 #endif
     scaleMode8_7_ = Frens::applyScreenMode(ScreenMode::NOSCANLINE_1_1);
     abSwapped = 1; // Swap A and B buttons, so menu is consistent across different emulators
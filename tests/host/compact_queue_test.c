@@ -0,0 +1,114 @@
+// Checks that the compact data-island queue (HSTX_DI_QUEUE_COMPACT=1), which
+// stores raw samples and encodes them in the DMA IRQ, sends the same island
+// words the default queue sends: what the producer would have encoded with
+// hstx_packet_set_audio_samples_cs and hstx_encode_data_island. Random
+// pushes, stages and multi-packet lines cover lines that take several staged
+// packets and packets that are queued but not staged yet. The encoder is
+// wrapped (-Wl,--wrap) to check the cycle bound: at most
+// HSTX_DI_STAGE_MAX_ENCODES per stage, none while a line takes its packets.
+// Also prints the host cost of staging one packet; there is no on-target
+// cycle benchmark.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hstx_data_island_queue.h"
+
+#if !HSTX_DI_QUEUE_COMPACT
+#error build with HSTX_DI_QUEUE_COMPACT=1
+#endif
+
+#define STEPS 200000
+#define SAMPLE_RATE 48000
+
+void *frens_f_malloc(size_t size)
+{
+    (void)size;
+    return NULL;
+}
+
+static int encodes;
+void __real_hstx_encode_data_island(hstx_data_island_t *out, const hstx_packet_t *packet, bool vsync, bool hsync);
+void __wrap_hstx_encode_data_island(hstx_data_island_t *out, const hstx_packet_t *packet, bool vsync, bool hsync)
+{
+    encodes++;
+    __real_hstx_encode_data_island(out, packet, vsync, hsync);
+}
+
+// Islands the default queue would hold, oldest first
+static hstx_data_island_t expected[1 << 10];
+static unsigned expected_head, expected_tail;
+
+static void push(void)
+{
+    static int frame_count = 0;
+    audio_sample_t samples[4];
+    for (int i = 0; i < 4; i++) {
+        samples[i].left = (int16_t)rand();
+        samples[i].right = (int16_t)rand();
+    }
+    if (!hstx_di_queue_push_samples(samples, frame_count))
+        return;
+    hstx_packet_t packet;
+    (void)hstx_packet_set_audio_samples_cs(&packet, samples, 4, frame_count);
+    hstx_encode_data_island(&expected[expected_head++ & 1023], &packet, false, true);
+    frame_count = (frame_count + 4) % 192;
+}
+
+int main(void)
+{
+    srand(7);
+    hstx_packet_set_cs_sample_rate(SAMPLE_RATE);
+    hstx_di_queue_init();
+    hstx_di_queue_set_sample_rate(SAMPLE_RATE);
+    // One packet falls due per tick
+    hstx_di_queue_set_line_rate(SAMPLE_RATE / 4);
+
+    int mismatches = 0, sent = 0, staged_lines = 0, unbounded = 0;
+    for (int step = 0; step < STEPS; step++) {
+        for (int n = rand() % 4; n; n--)
+            push();
+        if (rand() & 1) {
+            int before = encodes;
+            hstx_di_queue_stage();
+            if (encodes - before > HSTX_DI_STAGE_MAX_ENCODES && unbounded++ < 10)
+                printf("FAIL step %d: %d encodes in one stage\n", step, encodes - before);
+            staged_lines++;
+        }
+        for (int n = rand() % HSTX_DI_MAX_PACKETS_PER_LINE + 1; n; n--)
+            hstx_di_queue_tick();
+        const uint32_t *packets[HSTX_DI_MAX_PACKETS_PER_LINE];
+        uint32_t underruns = hstx_di_queue_get_underrun_count();
+        int before = encodes;
+        int count = hstx_di_queue_get_audio_packets(packets, rand() % HSTX_DI_MAX_PACKETS_PER_LINE + 1);
+        if (encodes != before && unbounded++ < 10)
+            printf("FAIL step %d: packet encoded on the sending line\n", step);
+        // Underruns send silence, in order after the queued packets
+        count -= (int)(hstx_di_queue_get_underrun_count() - underruns);
+        for (int i = 0; i < count; i++, sent++) {
+            const hstx_data_island_t *e = &expected[expected_tail++ & 1023];
+            if (memcmp(packets[i], e->words, sizeof(e->words)) != 0 && mismatches++ < 10)
+                printf("FAIL packet %d differs from the default queue\n", sent);
+        }
+    }
+
+    // Host cost of encoding one queued packet, as the IRQ does on a line with slack
+    audio_sample_t samples[4] = {{1, 2}, {3, 4}, {5, 6}, {7, 8}};
+    const int packets_timed = 200000;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int n = 0; n < packets_timed; n++) {
+        hstx_di_queue_push_samples(samples, n % 192);
+        hstx_di_queue_stage();
+        const uint32_t *words;
+        hstx_di_queue_tick();
+        hstx_di_queue_get_audio_packets(&words, 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / packets_timed;
+
+    printf("compact_queue_test: %d packets %s the default queue (%d lines staged ahead), %.0f ns per packet on the "
+           "host\n",
+           sent, mismatches ? "DIFFER from" : "match", staged_lines, ns);
+    return mismatches != 0 || unbounded != 0;
+}
@@ -0,0 +1,180 @@
+// Host model of the HSTX line clock driving the real data-island queue
+// (hstx_data_island_queue.c) the way video_output.c's DMA IRQ does: one
+// scheduler tick per line, no audio on vsync lines, ACR lines (every fourth
+// back-porch line) and the AVI InfoFrame line, and up to the mode's packets
+// per line everywhere else. A producer pushes the audio of either a whole
+// frame at once or every 16 lines. Each case runs 10 s with an empty queue
+// at the start and reports, after the first second, the peak queue depth,
+// the mean and worst time a packet spends queued and the worst lag of the
+// packets sent behind the sample clock, with one packet per line (the old
+// scheduler) and with several. With several packets per line there must be
+// no underruns or overruns and the lag must stay within one run of blocked
+// lines, whenever one burst fits in DI_RING_BUFFER_SIZE entries. A whole
+// frame at 96 kHz (400 packets) does not; such producers need a larger ring.
+#include <stdio.h>
+#include <string.h>
+#include "hstx_data_island_queue.h"
+#include "video_output.h"
+
+void host_set_video_mode(video_output_mode_t mode);
+
+#define SIM_SECONDS 10
+#define WARMUP_US 1e6
+#define LAG_LIMIT_US 500.0
+// Must match hstx_data_island_queue.c
+#ifndef DI_RING_BUFFER_SIZE
+#define DI_RING_BUFFER_SIZE 256
+#endif
+
+void *frens_f_malloc(size_t size)
+{
+    (void)size;
+    return NULL;
+}
+
+typedef struct {
+    int underruns, overruns, peak_depth;
+    double latency_avg_us, latency_max_us, lag_max_us;
+} sim_result_t;
+
+// Push time of every queued packet, oldest first
+static double push_time[1 << 16];
+static unsigned push_head, push_tail;
+
+static void push_packet(double t, int *frame_count)
+{
+#if HSTX_DI_QUEUE_COMPACT
+    audio_sample_t samples[4];
+    memset(samples, 0, sizeof(samples));
+    if (!hstx_di_queue_push_samples(samples, *frame_count))
+        return;
+#else
+    static hstx_data_island_t island;
+    if (!hstx_di_queue_push(&island))
+        return;
+#endif
+    *frame_count = (*frame_count + 4) % 192;
+    push_time[push_head++ & 0xFFFF] = t;
+}
+
+static void run(int rate, int chunk_lines, int max_per_line, sim_result_t *r)
+{
+    const video_timing_t *timing = video_output_get_timing();
+    uint32_t h_total = VIDEO_TIMING_H_TOTAL(timing), v_total = VIDEO_TIMING_V_TOTAL(timing);
+    uint32_t line_rate = MODE_PIXEL_CLOCK_HZ / h_total;
+    uint32_t sync_start = timing->v_front_porch, sync_end = sync_start + timing->v_sync_width;
+    uint32_t active_start = v_total - timing->v_active_lines;
+    double line_us = 1e6 / line_rate;
+    if (chunk_lines == 0)
+        chunk_lines = (int)v_total;
+
+    hstx_di_queue_init();
+    hstx_di_queue_set_line_rate(line_rate);
+    hstx_di_queue_set_sample_rate(rate);
+    push_head = push_tail = 0;
+    memset(r, 0, sizeof(*r));
+    uint32_t underruns = 0, overruns = 0, level = 0;
+    double produced = 0, due = 0, latency_sum = 0;
+    long sent = 0, latency_count = 0;
+    int frame_count = 0, warm = 0;
+
+    for (long line = 0; line < (long)SIM_SECONDS * (long)line_rate; line++) {
+        uint32_t v = (uint32_t)(line % v_total);
+        double t = line * line_us;
+        if (!warm && t >= WARMUP_US) {
+            warm = 1;
+            underruns = hstx_di_queue_get_underrun_count();
+            overruns = hstx_di_queue_get_overrun_count();
+        }
+        if (line % chunk_lines == chunk_lines - 1) {
+            produced += (double)rate * chunk_lines / line_rate / 4;
+            for (; produced >= 1; produced--)
+                push_packet(t, &frame_count);
+        }
+        level = hstx_di_queue_get_level();
+
+        hstx_di_queue_tick();
+        bool vsync = v >= sync_start && v < sync_end;
+        bool acr = v >= sync_end && v < active_start && v % 4 == 0;
+        const uint32_t *packets[HSTX_DI_MAX_PACKETS_PER_LINE];
+        int count = 0;
+        if (!vsync && !acr && v != 0)
+            count = hstx_di_queue_get_audio_packets(packets, max_per_line);
+#if HSTX_DI_QUEUE_COMPACT
+        // video_output stages on every line but the vsync lines
+        if (!vsync)
+            hstx_di_queue_stage();
+#endif
+        sent += count;
+        due += (double)rate / 4 / line_rate;
+
+        uint32_t new_level = hstx_di_queue_get_level();
+        for (uint32_t popped = level - new_level; popped; popped--) {
+            double queued = t - push_time[push_tail++ & 0xFFFF];
+            if (warm) {
+                latency_sum += queued;
+                latency_count++;
+                if (queued > r->latency_max_us)
+                    r->latency_max_us = queued;
+            }
+        }
+        if (warm) {
+            if ((int)new_level > r->peak_depth)
+                r->peak_depth = (int)new_level;
+            double lag_us = (due - sent) * 4 * 1e6 / rate;
+            if (lag_us > r->lag_max_us)
+                r->lag_max_us = lag_us;
+        }
+    }
+    r->underruns = (int)(hstx_di_queue_get_underrun_count() - underruns);
+    r->overruns = (int)(hstx_di_queue_get_overrun_count() - overruns);
+    r->latency_avg_us = latency_count ? latency_sum / latency_count : 0;
+}
+
+static void print_result(const sim_result_t *r)
+{
+    if (r->underruns || r->overruns)
+        printf("%5d under %5d over, lag %6.0f us", r->underruns, r->overruns, r->lag_max_us);
+    else
+        printf("depth %3d, %5.2f/%5.2f ms, lag %3.0f us", r->peak_depth, r->latency_avg_us / 1000,
+               r->latency_max_us / 1000, r->lag_max_us);
+}
+
+int main(void)
+{
+    static const struct {
+        video_output_mode_t mode;
+        const char *name;
+    } modes[] = {{VIDEO_OUTPUT_MODE_640x480, "480p"}, {VIDEO_OUTPUT_MODE_1280x240, "240p"}};
+    static const int rates[] = {32000, 44100, 48000, 96000};
+    static const int chunks[] = {0, 16};
+    int failures = 0;
+    printf("     producer  mode   rate | 1 packet/line                        | n packets/line\n");
+    for (int c = 0; c < 2; c++)
+        for (int m = 0; m < 2; m++)
+            for (int i = 0; i < 4; i++) {
+                host_set_video_mode(modes[m].mode);
+                const video_timing_t *timing = video_output_get_timing();
+                // As video_output.c: what fits in the sync pulse
+                int per_line = (timing->h_sync_width - W_PREAMBLE - 2 * W_GUARDBAND - 1) / W_DATA_PACKET;
+                if (per_line > HSTX_DI_MAX_PACKETS_PER_LINE)
+                    per_line = HSTX_DI_MAX_PACKETS_PER_LINE;
+                sim_result_t single, multi;
+                run(rates[i], chunks[c], 1, &single);
+                run(rates[i], chunks[c], per_line, &multi);
+                int burst = (int)((double)rates[i] * (chunks[c] ? chunks[c] : (int)VIDEO_TIMING_V_TOTAL(timing)) /
+                                  (MODE_PIXEL_CLOCK_HZ / VIDEO_TIMING_H_TOTAL(timing)) / 4) + 1;
+                bool fits = burst < DI_RING_BUFFER_SIZE;
+                bool ok = !fits || (!multi.underruns && !multi.overruns && multi.lag_max_us <= LAG_LIMIT_US);
+                printf("%s %-9s %s %6d | ", !fits ? "n/a " : ok ? "ok  " : "FAIL", chunks[c] ? "16 lines" : "frame",
+                       modes[m].name, rates[i]);
+                print_result(&single);
+                printf(" | %d: ", per_line);
+                print_result(&multi);
+                printf("\n");
+                failures += !ok;
+            }
+    printf("di_line_clock_sim: %s%s\n", failures ? "FAILED" : "passed",
+           HSTX_DI_QUEUE_COMPACT ? " (compact queue)" : "");
+    return failures != 0;
+}
@@ -0,0 +1,116 @@
+// Host simulation of hstx_paceFrame (hstx.c): the emulator's frame rates
+// paced on each HDMI mode for an hour of emulated frames. Waiting advances
+// the display by one vsync (video_frame_count), the frame itself takes no
+// time unless it is one of the slow frames of the overrun run. Checks:
+//  - every call advances by floor or ceil of display rate / frame rate,
+//  - after N frames the display is exactly floor(N * display / frame rate)
+//    vsyncs on, so there is no long-term drift,
+//  - with a slow frame every 100 frames, overruns are reported as dropped
+//    vsyncs and the schedule moves on by exactly that many.
+// The mean interval between the odd steps is printed, e.g. one double vsync
+// every ~344 frames for PC Engine on 60 Hz.
+#include <stdio.h>
+#include "../../drivers/pico_hdmi/hstx.c"
+
+void host_set_video_mode(video_output_mode_t mode);
+
+#define SIM_FRAMES (60 * 60 * 60)
+#define SLOW_FRAME_EVERY 100
+#define SLOW_FRAME_VSYNCS 3
+
+// FrensHelpers.h FrameRates
+static const struct {
+    const char *name;
+    uint32_t num, den;
+} rates[] = {
+    {"PCE NTSC", 598261, 10000},         {"NES/SNES NTSC", 118125000, 1965513},
+    {"NES PAL", 10640685, 212784},       {"Game Boy", 4194304, 70224},
+    {"SMS/Genesis NTSC", 53693175, 896040}, {"SMS/Genesis PAL", 53203424, 1070460},
+    {"PAL 50", 50, 1},                   {"NTSC 60", 60, 1},
+};
+
+static const struct {
+    video_output_mode_t mode;
+    const char *name;
+} modes[] = {
+    {VIDEO_OUTPUT_MODE_640x480, "480p 60"},
+    {VIDEO_OUTPUT_MODE_1280x240, "240p 60"},
+    {VIDEO_OUTPUT_MODE_640x480_50, "480p 50"},
+    {VIDEO_OUTPUT_MODE_1280x240_50, "240p 50"},
+};
+
+// The display shows the next frame while the caller waits
+static void next_vsync(void)
+{
+    video_frame_count++;
+}
+
+// Runs SIM_FRAMES paced frames, returns nonzero on failure
+static int run(int m, int r, int slow_frames)
+{
+    const video_timing_t *t = video_output_get_timing();
+    uint64_t frame_total = (uint64_t)VIDEO_TIMING_H_TOTAL(t) * VIDEO_TIMING_V_TOTAL(t);
+    // Display vsyncs per emulated frame, as the fraction vsync_num / vsync_den
+    uint64_t vsync_num = (uint64_t)MODE_PIXEL_CLOCK_HZ * rates[r].den;
+    uint64_t vsync_den = frame_total * rates[r].num;
+    uint32_t step_lo = (uint32_t)(vsync_num / vsync_den);
+    uint32_t step_hi = step_lo + (vsync_num % vsync_den != 0);
+
+    hstx_setFrameRate(rates[r].num, rates[r].den);
+    video_frame_count = 1000;
+    uint32_t start = video_frame_count;
+    int bad_steps = 0, hi_steps = 0, dropped = 0, lost = 0;
+    for (long n = 0; n < SIM_FRAMES; n++) {
+        if (slow_frames && n % SLOW_FRAME_EVERY == SLOW_FRAME_EVERY - 1) {
+            video_frame_count += SLOW_FRAME_VSYNCS;
+            lost += SLOW_FRAME_VSYNCS;
+        }
+        uint32_t before = video_frame_count;
+        int lag = hstx_paceFrame(n == 0);
+        dropped += lag;
+        if (lag)
+            continue;
+        uint32_t step = video_frame_count - before;
+        if (step != step_lo && step != step_hi)
+            bad_steps++;
+        hi_steps += step != step_lo;
+    }
+    // The expected vsyncs; the first call waits for its share as well
+    uint64_t expect = (uint64_t)(((unsigned __int128)vsync_num * SIM_FRAMES) / vsync_den) + dropped;
+    uint64_t got = video_frame_count - start;
+
+    int fail;
+    if (!slow_frames) {
+        fail = bad_steps || got != expect;
+        printf("%s %-7s %-16s: %lu vsyncs for %d frames (exact %lu)", fail ? "FAIL" : "ok  ", modes[m].name,
+               rates[r].name, (unsigned long)got, SIM_FRAMES, (unsigned long)expect);
+        // The rarer of the two steps, e.g. the double vsync for PCE on 60 Hz
+        int rare = hi_steps * 2 < SIM_FRAMES ? hi_steps : SIM_FRAMES - hi_steps;
+        if (rare)
+            printf(", a step of %u every %.1f frames", hi_steps * 2 < SIM_FRAMES ? step_hi : step_lo,
+                   (double)SIM_FRAMES / rare);
+        printf("\n");
+    } else {
+        // The schedule moves on by exactly the vsyncs reported dropped
+        fail = bad_steps || dropped <= 0 || dropped > lost || got != expect;
+        printf("%s %-7s %-16s: %d slow frames took %d vsyncs, %d reported dropped, %lu vsyncs (expected %lu)\n",
+               fail ? "FAIL" : "ok  ", modes[m].name, rates[r].name, SIM_FRAMES / SLOW_FRAME_EVERY, lost, dropped,
+               (unsigned long)got, (unsigned long)expect);
+    }
+    return fail;
+}
+
+int main(void)
+{
+    host_wfe_hook = next_vsync;
+    int failures = 0;
+    for (int m = 0; m < (int)count_of(modes); m++) {
+        host_set_video_mode(modes[m].mode);
+        for (int r = 0; r < (int)count_of(rates); r++)
+            failures += run(m, r, 0);
+    }
+    host_set_video_mode(VIDEO_OUTPUT_MODE_640x480);
+    failures += run(0, 0, 1);
+    printf("frame_pacing_sim: %s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
@@ -0,0 +1,121 @@
+// Bit-exact check of the data-island encoder and packet builders
+// (hstx_packet.c) against the original bit-serial implementation in
+// ref/hstx_packet_baseline.c, over 200000 packets of random bytes with every
+// vsync/hsync combination, plus random audio sample, ACR and InfoFrame
+// packets at each channel-status sample rate.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hstx_packet.h"
+
+// The reference under its own names; it includes hstx_packet.h again, which
+// the include guard skips.
+#define hstx_packet_init base_packet_init
+#define hstx_packet_set_null base_packet_set_null
+#define hstx_packet_set_acr base_packet_set_acr
+#define hstx_packet_set_audio_infoframe base_packet_set_audio_infoframe
+#define hstx_packet_set_avi_infoframe base_packet_set_avi_infoframe
+#define hstx_packet_set_cs_sample_rate base_packet_set_cs_sample_rate
+#define hstx_packet_set_audio_samples_cs base_packet_set_audio_samples_cs
+#define hstx_packet_set_audio_samples base_packet_set_audio_samples
+#define hstx_encode_data_island base_encode_data_island
+#define hstx_get_null_data_island base_get_null_data_island
+#include "ref/hstx_packet_baseline.c"
+#undef hstx_packet_init
+#undef hstx_packet_set_null
+#undef hstx_packet_set_acr
+#undef hstx_packet_set_audio_infoframe
+#undef hstx_packet_set_avi_infoframe
+#undef hstx_packet_set_cs_sample_rate
+#undef hstx_packet_set_audio_samples_cs
+#undef hstx_packet_set_audio_samples
+#undef hstx_encode_data_island
+#undef hstx_get_null_data_island
+
+#define RANDOM_PACKETS 200000
+
+static int failures;
+
+static void check(const char *what, int n, const void *got, const void *expect, size_t bytes)
+{
+    if (memcmp(got, expect, bytes) != 0 && failures++ < 10)
+        printf("FAIL %s %d\n", what, n);
+}
+
+// Encodes the packet with both encoders for every vsync/hsync combination
+static void check_encode(const char *what, int n, const hstx_packet_t *packet)
+{
+    for (int sync = 0; sync < 4; sync++) {
+        hstx_data_island_t got, expect;
+        hstx_encode_data_island(&got, packet, sync & 2, sync & 1);
+        base_encode_data_island(&expect, packet, sync & 2, sync & 1);
+        check(what, n, &got, &expect, sizeof(got));
+    }
+}
+
+static void random_samples(audio_sample_t *samples, int count)
+{
+    for (int i = 0; i < count; i++) {
+        samples[i].left = (int16_t)rand();
+        samples[i].right = (int16_t)rand();
+    }
+}
+
+int main(void)
+{
+    srand(42);
+    hstx_packet_t got, expect;
+
+    for (int n = 0; n < RANDOM_PACKETS; n++) {
+        uint8_t *bytes = (uint8_t *)&got;
+        for (size_t i = 0; i < sizeof(got); i++)
+            bytes[i] = (uint8_t)rand();
+        check_encode("random packet", n, &got);
+    }
+
+    for (int sync = 0; sync < 4; sync++)
+        check("null island", sync, hstx_get_null_data_island(sync & 2, sync & 1),
+              base_get_null_data_island(sync & 2, sync & 1), HSTX_DATA_ISLAND_WORDS * sizeof(uint32_t));
+
+    static const uint32_t rates[] = {32000, 44100, 48000, 96000};
+    for (int r = 0; r < 4; r++) {
+        hstx_packet_set_cs_sample_rate(rates[r]);
+        base_packet_set_cs_sample_rate(rates[r]);
+        for (int n = 0; n < 2000; n++) {
+            audio_sample_t samples[4];
+            int count = 1 + rand() % 4;
+            int frame = rand() % 192;
+            random_samples(samples, count);
+            int got_next = hstx_packet_set_audio_samples_cs(&got, samples, count, frame);
+            int expect_next = base_packet_set_audio_samples_cs(&expect, samples, count, frame);
+            check("audio samples cs", n, &got, &expect, sizeof(got));
+            check("audio samples cs frame", n, &got_next, &expect_next, sizeof(int));
+            check_encode("audio samples cs", n, &got);
+
+            got_next = hstx_packet_set_audio_samples(&got, samples, count, frame);
+            expect_next = base_packet_set_audio_samples(&expect, samples, count, frame);
+            check("audio samples", n, &got, &expect, sizeof(got));
+            check("audio samples frame", n, &got_next, &expect_next, sizeof(int));
+        }
+
+        uint32_t acr_n = (uint32_t)rand() & 0xFFFFF, cts = (uint32_t)rand() & 0xFFFFF;
+        hstx_packet_set_acr(&got, acr_n, cts);
+        base_packet_set_acr(&expect, acr_n, cts);
+        check("ACR", r, &got, &expect, sizeof(got));
+        check_encode("ACR", r, &got);
+
+        hstx_packet_set_audio_infoframe(&got, rates[r], 2, 16);
+        base_packet_set_audio_infoframe(&expect, rates[r], 2, 16);
+        check("audio InfoFrame", r, &got, &expect, sizeof(got));
+        check_encode("audio InfoFrame", r, &got);
+
+        hstx_packet_set_avi_infoframe(&got, (uint8_t)(1 + r), (uint8_t)(r & 1));
+        base_packet_set_avi_infoframe(&expect, (uint8_t)(1 + r), (uint8_t)(r & 1));
+        check("AVI InfoFrame", r, &got, &expect, sizeof(got));
+        check_encode("AVI InfoFrame", r, &got);
+    }
+
+    printf("packet_encoder_test: %s against the baseline encoder (%d random packets)\n",
+           failures ? "MISMATCH" : "bit-exact", RANDOM_PACKETS);
+    return failures != 0;
+}
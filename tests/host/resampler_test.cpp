@@ -0,0 +1,181 @@
+// Frequency response, images/aliases and cost of the shared audio resampler
+// (AudioResampler.cpp) at the rate pairs the emulators use. Each tone is a
+// half-second sine at -6 dBFS; levels are read from the output with a
+// Hann-windowed DFT at the tone and at its image (the input rate minus the
+// tone, folded into the output band). The limits are the figures documented
+// at ResamplerQuality, as the worst case over all rate pairs.
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "AudioResampler.h"
+
+using namespace Frens;
+
+static const int amplitude = 16384;
+static std::vector<float> output;
+
+static void collect(const int16_t *lr, int frames)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        output.push_back(lr[i * 2]);
+    }
+}
+
+static void discard(const int16_t *, int)
+{
+}
+
+static void runTone(int inRate, int outRate, ResamplerQuality quality, double freq)
+{
+    audioResamplerInit(inRate, outRate, quality);
+    setAudioResamplerSink(collect);
+    output.clear();
+    for (int i = 0; i < inRate / 2; i++)
+    {
+        int s = (int)lrint(amplitude * sin(2 * M_PI * freq * i / inRate));
+        audioResamplerPushSample(s, s);
+    }
+    audioResamplerFlush();
+}
+
+// Level of freq in the output relative to the input tone, in dB. The first
+// samples (filter start-up) are skipped.
+static double levelDb(double freq, int outRate)
+{
+    const int start = 100;
+    int n = (int)output.size() - start;
+    double re = 0, im = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double w = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+        re += w * output[start + i] * cos(2 * M_PI * freq * i / outRate);
+        im += w * output[start + i] * sin(2 * M_PI * freq * i / outRate);
+    }
+    return 20 * log10(4 * sqrt(re * re + im * im) / n / amplitude + 1e-12);
+}
+
+static double fold(double freq, int rate)
+{
+    freq = fmod(freq, rate);
+    return freq > rate / 2.0 ? rate - freq : freq;
+}
+
+struct Limits
+{
+    ResamplerQuality quality;
+    const char *name;
+    double flatTo;        // fraction of the lower Nyquist frequency ...
+    double flatDb;        // ... up to which the response stays within this
+    double imageHalfDb;   // worst image/alias for tones up to half the band
+    double imageEightyDb; // ... and up to 80% of it
+};
+
+// The figures at ResamplerQuality
+static const Limits limits[] = {
+    {ResamplerQuality::Linear, "Linear", 0.5, -2.5, -20, -10},
+    {ResamplerQuality::Sinc8, "Sinc8", 0.5, -1, -40, -20},
+    {ResamplerQuality::Sinc16, "Sinc16", 0.6, -0.2, -40, -40},
+};
+
+static const int ratePairs[][2] = {{32000, 48000}, {44100, 48000}, {53280, 44100}, {48000, 44100}};
+
+int main()
+{
+    int failures = 0;
+    for (const Limits &l : limits)
+    {
+        double flat = 0, half = -200, eighty = -200, cutoffEdge = -200;
+        for (const auto &rates : ratePairs)
+        {
+            int in = rates[0], out = rates[1];
+            double nyquist = (in < out ? in : out) / 2.0;
+            for (double r = 0.025; r * nyquist < 0.99 * in / 2; r += 0.025)
+            {
+                double tone = r * nyquist;
+                runTone(in, out, l.quality, tone);
+                if (r <= l.flatTo + 1e-9)
+                {
+                    double gain = levelDb(tone, out);
+                    flat = gain < flat ? gain : flat;
+                }
+                double image = fold(in - tone, out);
+                if (fabs(image - fold(tone, out)) < 200)
+                {
+                    continue; // too close to the tone to measure
+                }
+                double level = levelDb(image, out);
+                if (r <= 0.5 + 1e-9 && level > half)
+                {
+                    half = level;
+                }
+                if (r <= 0.8 + 1e-9 && level > eighty)
+                {
+                    eighty = level;
+                }
+                if (level > cutoffEdge)
+                {
+                    cutoffEdge = level;
+                }
+            }
+        }
+
+        // Cost per output sample on this host, 44.1 kHz to 48 kHz
+        audioResamplerInit(44100, 48000, l.quality);
+        setAudioResamplerSink(discard);
+        std::vector<int16_t> block(2 * 1024);
+        for (int16_t &s : block)
+        {
+            s = (int16_t)rand();
+        }
+        const int blocks = 2000;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int b = 0; b < blocks; b++)
+        {
+            audioResamplerPush(block.data(), 1024);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() /
+                    (blocks * 1024.0 * 48000 / 44100);
+
+        bool ok = flat >= l.flatDb && half <= l.imageHalfDb && eighty <= l.imageEightyDb;
+        printf("%-6s %s: %.1f dB to %.0f%% of the band, images %.1f dB to 50%%, %.1f dB to 80%%, "
+               "%.1f dB near the cut-off, %.1f ns per output sample\n",
+               l.name, ok ? "ok  " : "FAIL", flat, l.flatTo * 100, half, eighty, cutoffEdge, ns);
+        failures += !ok;
+    }
+
+    // DC passes at unity gain and equal rates pass straight through
+    audioResamplerInit(32000, 48000, ResamplerQuality::Sinc16);
+    setAudioResamplerSink(collect);
+    output.clear();
+    for (int i = 0; i < 1000; i++)
+    {
+        audioResamplerPushSample(12345, 12345);
+    }
+    audioResamplerFlush();
+    if (output[100] != 12345 || output.back() != 12345)
+    {
+        printf("FAIL DC gain: %.0f %.0f\n", output[100], output.back());
+        failures++;
+    }
+    audioResamplerInit(48000, 48000, ResamplerQuality::Sinc8);
+    output.clear();
+    for (int i = 0; i < 1000; i++)
+    {
+        audioResamplerPushSample(i * 37 - 16000, 0);
+    }
+    audioResamplerFlush();
+    for (int i = 0; i < 1000; i++)
+    {
+        if (output[i] != i * 37 - 16000)
+        {
+            printf("FAIL pass-through: sample %d\n", i);
+            failures++;
+            break;
+        }
+    }
+    printf("resampler_test: %s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
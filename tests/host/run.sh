@@ -0,0 +1,89 @@
+:
+# Builds and runs the host tests with the system compiler. The driver and
+# helper sources are compiled against the stand-ins in tests/host/stubs, so
+# neither the Pico SDK nor an Arm toolchain is needed.
+#
+# Usage: tests/host/run.sh [test ...]   (no arguments: all tests)
+# Set CC / CXX to pick the compilers, OUT for the build directory.
+cd `dirname $0` || exit 1
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+OUT=${OUT:-${TMPDIR:-/tmp}/pico_shared_host_tests}
+HDMI=../../drivers/pico_hdmi
+CXXFLAGS="-std=gnu++17 -O2 -Wall -Istubs -I$OUT/src"
+CFLAGS="-std=gnu11 -O2 -Wall -Wno-unused-function -Wno-unused-variable -Wno-format -DPICO_RP2350=1 -Istubs -I$HDMI"
+HSTX_SRCS="video_output_host.c $HDMI/hstx_data_island_queue.c $HDMI/hstx_packet.c"
+mkdir -p $OUT || exit 1
+
+function build_scanline_test() {
+	$CC $CFLAGS scanline_test.c $HSTX_SRCS -o $OUT/scanline_test &&
+	$CC $CFLAGS -DHSTX_FRAMEBUFFER_PSRAM=1 scanline_test.c $HSTX_SRCS -o $OUT/scanline_test_psram
+}
+function run_scanline_test() {
+	$OUT/scanline_test && $OUT/scanline_test_psram
+}
+
+# C++ helpers include FrensHelpers.h and settings.h with quotes, which would
+# find the real headers next to them, so they are built from a copy.
+function build_resampler_test() {
+	mkdir -p $OUT/src && cp ../../AudioResampler.cpp ../../AudioResampler.h $OUT/src &&
+	$CXX $CXXFLAGS resampler_test.cpp $OUT/src/AudioResampler.cpp -o $OUT/resampler_test
+}
+function run_resampler_test() {
+	$OUT/resampler_test
+}
+
+function build_servo_sim() {
+	mkdir -p $OUT/src && cp ../../AudioResampler.cpp ../../AudioResampler.h $OUT/src &&
+	$CXX $CXXFLAGS servo_sim.cpp $OUT/src/AudioResampler.cpp -o $OUT/servo_sim
+}
+function run_servo_sim() {
+	$OUT/servo_sim
+}
+
+function build_packet_encoder_test() {
+	$CC $CFLAGS packet_encoder_test.c $HDMI/hstx_packet.c -o $OUT/packet_encoder_test
+}
+function run_packet_encoder_test() {
+	$OUT/packet_encoder_test
+}
+
+function build_frame_pacing_sim() {
+	$CC $CFLAGS frame_pacing_sim.c $HSTX_SRCS -o $OUT/frame_pacing_sim
+}
+function run_frame_pacing_sim() {
+	$OUT/frame_pacing_sim
+}
+
+function build_di_line_clock_sim() {
+	$CC $CFLAGS di_line_clock_sim.c $HSTX_SRCS -o $OUT/di_line_clock_sim &&
+	$CC $CFLAGS -DHSTX_DI_QUEUE_COMPACT=1 di_line_clock_sim.c $HSTX_SRCS -o $OUT/di_line_clock_sim_compact
+}
+function run_di_line_clock_sim() {
+	$OUT/di_line_clock_sim && $OUT/di_line_clock_sim_compact
+}
+
+function build_compact_queue_test() {
+	$CC $CFLAGS -DHSTX_DI_QUEUE_COMPACT=1 compact_queue_test.c $HDMI/hstx_data_island_queue.c $HDMI/hstx_packet.c \
+		-Wl,--wrap=hstx_encode_data_island -o $OUT/compact_queue_test
+}
+function run_compact_queue_test() {
+	$OUT/compact_queue_test
+}
+
+ALL="scanline_test resampler_test servo_sim packet_encoder_test frame_pacing_sim di_line_clock_sim compact_queue_test"
+TESTS=${*:-$ALL}
+FAILED=""
+for t in $TESTS; do
+	echo "== $t"
+	if ! build_$t; then
+		FAILED="$FAILED $t(build)"
+	elif ! run_$t; then
+		FAILED="$FAILED $t"
+	fi
+done
+if [ -n "$FAILED" ]; then
+	echo "Failed:$FAILED"
+	exit 1
+fi
+echo "All host tests passed."
@@ -0,0 +1,146 @@
+// Bit-exact check of the HSTX scanline callback (hstx.c) against the output of
+// the original single-loop implementation, for every combination of pixel
+// format, 8:7 scaling, scanlines and LCD type in 480p and 240p. In 480p each
+// frame runs three times: as video_output calls it, with the odd line of a
+// row taken from the cached even line; with the cache forced to miss so the
+// odd-line kernels expand the row themselves; with one line buffer for all
+// lines, where the odd line overwrites the buffer it would copy from; and
+// with the settings changed between the even and odd line of every row, where
+// the cached even line is stale and only the odd lines are checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../drivers/pico_hdmi/hstx.c"
+
+void host_set_video_mode(video_output_mode_t mode);
+
+#define DM 0x7BDEu // per-channel LSBs cleared, for halving RGB555
+
+static uint16_t test_palette[256];
+
+// One 640-pixel output line the way the original code produced it: pixels
+// doubled (1:1) or stretched 7 -> 16 from column 34 between 32-pixel black
+// borders (8:7), the whole line halved on odd lines with scanlines on, and
+// every odd column halved once more for the LCD type.
+static void reference_line(const uint8_t *fb, int indexed, int row, int dark, int ar87, int lcd, uint16_t *out)
+{
+    uint16_t src[HRes];
+    for (int x = 0; x < HRes; x++) {
+        uint16_t px = indexed ? (uint16_t)(test_palette[fb[row * HRes + x]] & 0x7FFFu)
+                              : (uint16_t)(fb[(row * HRes + x) * 2] | fb[(row * HRes + x) * 2 + 1] << 8);
+        src[x] = dark ? (uint16_t)((px & DM) >> 1) : px;
+    }
+    if (ar87) {
+        static const int copies[7] = {2, 2, 3, 2, 2, 3, 2};
+        int o = 0;
+        while (o < 32)
+            out[o++] = 0;
+        for (int g = 0; g < 36; g++)
+            for (int k = 0; k < 7; k++)
+                for (int c = 0; c < copies[k]; c++)
+                    out[o++] = src[34 + g * 7 + k];
+        while (o < HSTX_LINE_PIXELS)
+            out[o++] = 0;
+    } else {
+        for (int x = 0; x < HRes; x++)
+            out[2 * x] = out[2 * x + 1] = src[x];
+    }
+    if (lcd)
+        for (int o = 1; o < HSTX_LINE_PIXELS; o += 2)
+            out[o] = (uint16_t)((out[o] & DM) >> 1);
+}
+
+static int compare(const uint32_t *line, const uint16_t *expect, int repeat)
+{
+    for (int o = 0; o < HSTX_LINE_PIXELS * repeat; o++) {
+        uint32_t word = line[o / 2];
+        uint16_t px = (uint16_t)(o & 1 ? word >> 16 : word);
+        if (px != expect[o / repeat])
+            return o;
+    }
+    return -1;
+}
+
+enum { PASS_CACHED, PASS_MISS, PASS_ONE_BUFFER, PASS_SETTINGS_CHANGE, PASSES };
+static const char *const pass_names[PASSES] = {"", " (cache miss)", " (one line buffer)", " (settings change)"};
+
+static void apply_settings(int indexed, int ar87, int scanlines, int lcd_type)
+{
+    hstx_setFramebufferFormat(indexed ? HSTX_FB_INDEXED8 : HSTX_FB_RGB555);
+    hstx_setAspectRatio87(ar87);
+    hstx_setScanLines(scanlines);
+    hstx_setScanLineType(lcd_type);
+}
+
+// Runs one frame, returns the number of wrong lines
+static int run_frame(const uint8_t *fb, int indexed, int ar87, int scanlines, int lcd_type, int pass)
+{
+    static uint32_t lines[2][HSTX_LINE_PIXELS]; // video_output's double-buffered line buffers
+    uint16_t expect[HSTX_LINE_PIXELS];
+    const video_timing_t *t = video_output_get_timing();
+    int doubled = t->v_active_lines != VRes;
+    int lcd = scanlines && lcd_type == 1;
+    int errors = 0;
+    hstx_vsync_callbackfunc();
+    for (uint32_t line = 0; line < t->v_active_lines; line++) {
+        uint32_t *buff = lines[pass == PASS_ONE_BUFFER ? 0 : line & 1];
+        if (pass != PASS_ONE_BUFFER)
+            memset(buff, 0xA5, sizeof(lines[0]));
+        if (pass == PASS_MISS)
+            cached_row = -1;
+        if (pass == PASS_SETTINGS_CHANGE)
+            apply_settings(line & 1 ? indexed : !indexed, line & 1 ? ar87 : !ar87, scanlines, lcd_type);
+        scanline_callbackfunc(0, line, buff);
+        if (pass == PASS_SETTINGS_CHANGE && !(line & 1))
+            continue;
+        int row = doubled ? (int)line >> 1 : (int)line;
+        int dark = doubled && (line & 1) && scanlines;
+        reference_line(fb, indexed, row, dark, ar87, lcd, expect);
+        int at = compare(buff, expect, doubled ? 1 : 2);
+        if (at >= 0 && errors++ == 0)
+            printf("  first mismatch: line %lu pixel %d\n", (unsigned long)line, at);
+    }
+    return errors;
+}
+
+int main(void)
+{
+    srand(1);
+    uint8_t *fb = hstx_getframebuffer();
+#if HSTX_FRAMEBUFFER_PSRAM
+    // Outside the stub's SRAM range, so scanout goes through the row prefetch
+    fb = malloc(HSTX_FRAMEBUFFER_BYTES);
+    hstx_setFramebufferMemory(fb);
+#endif
+    for (int i = 0; i < (int)HSTX_FRAMEBUFFER_BYTES; i++)
+        fb[i] = (uint8_t)rand();
+    for (int i = 0; i < 256; i++)
+        test_palette[i] = (uint16_t)rand();
+    hstx_setPalette(test_palette, 0, 256);
+
+    static const struct {
+        video_output_mode_t mode;
+        const char *name;
+    } modes[] = {{VIDEO_OUTPUT_MODE_640x480, "480p"}, {VIDEO_OUTPUT_MODE_1280x240, "240p"}};
+    int failures = 0, runs = 0;
+    for (int m = 0; m < 2; m++)
+        for (int indexed = 0; indexed < 2; indexed++)
+            for (int ar87 = 0; ar87 < 2; ar87++)
+                for (int scanlines = 0; scanlines < 2; scanlines++)
+                    for (int lcd_type = 0; lcd_type < 2; lcd_type++)
+                        for (int pass = 0; pass < (m == 0 ? PASSES : 1); pass++) {
+                            host_set_video_mode(modes[m].mode);
+                            apply_settings(indexed, ar87, scanlines, lcd_type);
+                            int errors = run_frame(fb, indexed, ar87, scanlines, lcd_type, pass);
+                            runs++;
+                            if (errors) {
+                                failures++;
+                                printf("FAIL %s %s %s scanlines %d lcd %d%s: %d lines differ\n", modes[m].name,
+                                       indexed ? "indexed" : "rgb555", ar87 ? "8:7" : "1:1", scanlines, lcd_type,
+                                       pass_names[pass], errors);
+                            }
+                        }
+    printf("scanline_test: %d of %d frames match the reference%s\n", runs - failures, runs,
+           HSTX_FRAMEBUFFER_PSRAM ? " (PSRAM prefetch)" : "");
+    return failures != 0;
+}
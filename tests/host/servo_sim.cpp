@@ -0,0 +1,120 @@
+// Host simulation of the audio clock-drift servo (AudioResampler.cpp) against
+// a modelled sink clock. The sink is a sample queue drained at the nominal
+// output rate off by the drift, with samples above its capacity dropped like
+// HDMI packets above HSTX_AUDIO_DI_HIGH_WATERMARK and silence when it runs
+// dry. The producer pushes either every 100 us or once per 60 Hz frame, the
+// bursty case the fill filter is there for. Each run covers 600 s at a
+// drift of +-300 ppm (typical crystals) and +-2000 ppm; with the servo on
+// there must be no drops and no underruns and the correction must settle on
+// the drift without saturating; without the servo every run must drop or run
+// dry, so the model is known to drift at all.
+// Settling is reported as the time from which the correction stays within
+// settleBandPpm of the drift. This is what AUDIO_SERVO_KP,
+// AUDIO_SERVO_KI_SHIFT and AUDIO_SERVO_FILTER_SHIFT were chosen against.
+#include <cmath>
+#include <cstdio>
+#include "AudioResampler.h"
+
+using namespace Frens;
+
+static const int inRate = 32040; // SNES
+static const int outRate = 48000;
+static const double tick = 1e-4; // seconds
+static const int frameTicks = 167;
+static const int seconds = 600;
+// The correction counts as settled once it stays this close to the drift
+static const int settleBandPpm = 100;
+static const double drifts[] = {-2000e-6, -300e-6, 300e-6, 2000e-6};
+
+static double capacity;
+static double level;
+static double dropped;
+static long underrunTicks;
+
+static void sinkQueue(const int16_t *, int frames)
+{
+    level += frames;
+    if (level > capacity)
+    {
+        dropped += level - capacity;
+        level = capacity;
+    }
+}
+
+static int queueFill()
+{
+    return (int)(level * 1000 / capacity);
+}
+
+int main()
+{
+    static int16_t silence[2 * 2000];
+    int failures = 0;
+    for (int servo = 1; servo >= 0; servo--)
+    {
+        for (double drift : drifts)
+        {
+            for (int burst = 0; burst < 2; burst++)
+            {
+                // Steady: the HDMI queue at its watermark (200 packets of 4
+                // samples). Bursty: with the audio FIFO in front of it.
+                capacity = burst ? 2400 : 800;
+                level = capacity / 2;
+                dropped = 0;
+                underrunTicks = 0;
+                audioResamplerInit(inRate, outRate, ResamplerQuality::Sinc8);
+                setAudioResamplerSink(sinkQueue);
+                setAudioDriftFillQuery(queueFill);
+                setAudioDriftServo(servo);
+                resetAudioServoStats();
+
+                double pending = 0, drain = outRate * (1 + drift) * tick;
+                double settledAt = -1;
+                for (long t = 1; t <= seconds * 10000L; t++)
+                {
+                    if (!burst || t % frameTicks == 0)
+                    {
+                        pending += inRate * tick * (burst ? frameTicks : 1);
+                        int frames = (int)pending;
+                        pending -= frames;
+                        audioResamplerPush(silence, frames);
+                    }
+                    if (level < drain)
+                    {
+                        underrunTicks++;
+                        level = 0;
+                    }
+                    else
+                    {
+                        level -= drain;
+                    }
+                    bool near = fabs(getAudioResamplerRatioPpm() + drift * 1e6) < settleBandPpm;
+                    if (!near)
+                    {
+                        settledAt = -1;
+                    }
+                    else if (settledAt < 0)
+                    {
+                        settledAt = t * tick;
+                    }
+                }
+
+                AudioServoStats stats;
+                getAudioServoStats(stats);
+                bool ok = servo ? dropped == 0 && underrunTicks == 0 && settledAt >= 0 && !stats.saturated
+                                : dropped > 0 || underrunTicks > 0;
+                printf("%s servo %-3s %+5.0f ppm %-6s: dropped %6.0f, underrun ticks %7ld, correction %+5d ppm",
+                       ok ? "ok  " : "FAIL", servo ? "on" : "off", drift * 1e6, burst ? "bursty" : "steady", dropped,
+                       underrunTicks, (int)getAudioResamplerRatioPpm());
+                if (servo)
+                {
+                    printf(", fill %d permille, settled after %.0f s", stats.fillPermille, settledAt);
+                }
+                printf("\n");
+                failures += !ok;
+            }
+        }
+    }
+    printf("servo_sim: %s\n", failures ? "FAILED" : "passed");
+    return failures != 0;
+}
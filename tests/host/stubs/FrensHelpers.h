@@ -0,0 +1,17 @@
+#pragma once
+// Host stand-in for FrensHelpers.h: the external DAC and headphone detection
+// and the audio fill query used by AudioResampler.cpp's defaults.
+#define EXT_AUDIO_ENQUEUE_SAMPLE(l, r) ((void)(l), (void)(r))
+
+namespace Frens
+{
+    inline bool isHeadPhoneJackConnected()
+    {
+        return false;
+    }
+
+    inline int getAudioOutputFillPermille()
+    {
+        return -1;
+    }
+}
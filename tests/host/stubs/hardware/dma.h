@@ -0,0 +1,97 @@
+#pragma once
+// One channel that copies on the host. A transfer completes a few busy polls
+// after it starts, so the HSTX row prefetch really runs behind and its stall
+// path is taken.
+#include <string.h>
+#include "pico.h"
+
+typedef struct {
+    int unused;
+} dma_channel_config;
+enum { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+#define HOST_DMA_POLLS 3
+extern struct host_dma {
+    void *write;
+    const void *read;
+    uint32_t words;
+    int polls_left; // 0: idle
+} host_dma;
+
+static inline int dma_claim_unused_channel(bool required)
+{
+    (void)required;
+    return 5;
+}
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    (void)channel;
+    dma_channel_config c = {0};
+    return c;
+}
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, int size)
+{
+    (void)c;
+    (void)size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+    (void)c;
+    (void)incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+    (void)c;
+    (void)incr;
+}
+
+static inline void dma_channel_configure(uint channel, const dma_channel_config *config, void *write_addr,
+                                         const void *read_addr, uint transfer_count, bool trigger)
+{
+    (void)channel;
+    (void)config;
+    (void)read_addr;
+    (void)transfer_count;
+    (void)trigger;
+    host_dma.write = write_addr;
+}
+
+static inline void dma_channel_set_write_addr(uint channel, void *write_addr, bool trigger)
+{
+    (void)channel;
+    (void)trigger;
+    host_dma.write = write_addr;
+}
+
+static inline void dma_channel_set_read_addr(uint channel, const void *read_addr, bool trigger)
+{
+    (void)channel;
+    (void)trigger;
+    host_dma.read = read_addr;
+}
+
+static inline void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+    (void)channel;
+    host_dma.words = trans_count;
+    if (trigger)
+        host_dma.polls_left = HOST_DMA_POLLS;
+}
+
+static inline bool dma_channel_is_busy(uint channel)
+{
+    (void)channel;
+    if (host_dma.polls_left && --host_dma.polls_left == 0)
+        memcpy(host_dma.write, host_dma.read, host_dma.words * 4);
+    return host_dma.polls_left != 0;
+}
+
+static inline void dma_channel_abort(uint channel)
+{
+    (void)channel;
+    host_dma.polls_left = 0;
+}
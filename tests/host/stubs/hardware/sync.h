@@ -0,0 +1,68 @@
+#pragma once
+#include "pico.h"
+
+// Set by a test to model the other core or the IRQs while the code under
+// test sleeps in WFE (e.g. advance video_frame_count).
+extern void (*host_wfe_hook)(void);
+
+static inline void __sev(void)
+{
+}
+
+static inline void __wfe(void)
+{
+    if (host_wfe_hook)
+        host_wfe_hook();
+}
+
+static inline void __dmb(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t save_and_disable_interrupts(void)
+{
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status)
+{
+    (void)status;
+}
+
+typedef volatile uint32_t spin_lock_t;
+extern spin_lock_t host_spin_lock;
+
+static inline int spin_lock_claim_unused(bool required)
+{
+    (void)required;
+    return 0;
+}
+
+static inline spin_lock_t *spin_lock_instance(uint lock_num)
+{
+    (void)lock_num;
+    return &host_spin_lock;
+}
+
+static inline uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+    (void)lock;
+    return 0;
+}
+
+static inline void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+    (void)lock;
+    (void)saved_irq;
+}
+
+static inline void spin_lock_unsafe_blocking(spin_lock_t *lock)
+{
+    (void)lock;
+}
+
+static inline void spin_unlock_unsafe(spin_lock_t *lock)
+{
+    (void)lock;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "pico.h"
+
+// Microseconds since boot, advanced by the test
+extern volatile uint32_t host_time_us;
+
+static inline uint32_t time_us_32(void)
+{
+    return host_time_us;
+}
@@ -0,0 +1,25 @@
+#pragma once
+// Host stand-in for the Pico SDK's pico.h: just what the driver and helper
+// sources built by tests/host/run.sh use.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define __not_in_flash_func(f) f
+#define __not_in_flash(group)
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#define SRAM_BASE 0x20000000u
+#define SRAM_END 0x20082000u
+typedef unsigned int uint;
+
+static inline void panic(const char *fmt, ...)
+{
+    fprintf(stderr, "panic: %s", fmt);
+    abort();
+}
+
+static inline void tight_loop_contents(void)
+{
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "pico.h"
+#include "hardware/sync.h"
+
+void multicore_launch_core1_with_stack(void (*entry)(void), uint32_t *stack_bottom, size_t stack_size_bytes);
+void multicore_reset_core1(void);
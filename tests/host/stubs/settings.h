@@ -0,0 +1,3 @@
+#pragma once
+// Host stand-in for settings.h; nothing in the host-built sources reads the
+// settings with HSTX off.
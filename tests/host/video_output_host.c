@@ -0,0 +1,94 @@
+// Host stand-in for video_output.c and the SDK calls hstx.c links against.
+// The tests drive the scanline callback, the vsync callback and the frame
+// counter themselves; the mode is picked with host_set_video_mode().
+#include <string.h>
+#include "video_output.h"
+#include "pico/multicore.h"
+#include "hardware/dma.h"
+#include "hardware/timer.h"
+
+volatile uint32_t video_frame_count = 0;
+volatile uint32_t host_time_us = 0;
+void (*host_wfe_hook)(void) = NULL;
+spin_lock_t host_spin_lock;
+struct host_dma host_dma;
+
+// Same timings as video_output.c
+static const video_timing_t video_timings[VIDEO_OUTPUT_MODE_COUNT] = {
+    [VIDEO_OUTPUT_MODE_640x480] = {16, 96, 48, 640, 10, 2, 33, 480, 1, 0},
+    [VIDEO_OUTPUT_MODE_1280x240] = {32, 192, 96, 1280, 4, 4, 14, 240, 1, 3},
+    [VIDEO_OUTPUT_MODE_640x480_50] = {16, 96, 48, 640, 58, 2, 90, 480, 0, 0},
+    [VIDEO_OUTPUT_MODE_1280x240_50] = {32, 192, 96, 1280, 30, 3, 42, 240, 0, 3},
+};
+static video_output_mode_t video_mode = VIDEO_OUTPUT_MODE_640x480;
+static uint32_t audio_sample_rate = 48000;
+
+void host_set_video_mode(video_output_mode_t mode)
+{
+    video_mode = mode;
+}
+
+const video_timing_t *video_output_get_timing(void)
+{
+    return &video_timings[video_mode];
+}
+
+video_output_mode_t video_output_get_mode(void)
+{
+    return video_mode;
+}
+
+void video_output_init(uint16_t width, uint16_t height)
+{
+    (void)width;
+    (void)height;
+}
+
+void video_output_stop(void)
+{
+}
+
+void video_output_core1_run(void)
+{
+}
+
+void video_output_set_dvi_mode(bool enabled)
+{
+    (void)enabled;
+}
+
+void video_output_set_scanline_callback(video_output_scanline_cb_t cb)
+{
+    (void)cb;
+}
+
+void video_output_set_vsync_callback(video_output_vsync_cb_t cb)
+{
+    (void)cb;
+}
+
+void video_output_set_audio_task(video_output_audio_task_fn task)
+{
+    (void)task;
+}
+
+void pico_hdmi_set_audio_sample_rate(uint32_t sample_rate)
+{
+    audio_sample_rate = sample_rate;
+}
+
+uint32_t pico_hdmi_get_audio_sample_rate(void)
+{
+    return audio_sample_rate;
+}
+
+void multicore_launch_core1_with_stack(void (*entry)(void), uint32_t *stack_bottom, size_t stack_size_bytes)
+{
+    (void)entry;
+    (void)stack_bottom;
+    (void)stack_size_bytes;
+}
+
+void multicore_reset_core1(void)
+{
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Build packed metadata databases from the loose metadata files.
+
+For every system directory under the metadata root, the files
+<root>/<sys>/descr/<c>/<CRC>.txt are packed into <root>/<sys>/metadata.db,
+which the menu (MetadataDb.cpp) searches with a single binary search.
+The loose files are left in place and are still used when no database exists.
+
+Usage: build_metadata_db.py <metadata root> [system ...]
+
+File layout (little endian), must match MetadataDb.h:
+  Header   magic "FMDB", u16 version, u16 fieldCount, u32 count, u32 indexOffset
+  Fanout   u32[257], first index entry whose CRC top byte is >= b, [256] = count
+  Index    count x (u32 crc, u32 recordOffset, u16 recordSize, u16 reserved), sorted on crc
+  Records  u16 fieldOffset[fieldCount] (from record start) + NUL-terminated strings
+"""
+import os
+import struct
+import sys
+
+MAGIC = b"FMDB"
+VERSION = 1
+# Order must match MetadataDb::Field
+FIELDS = ["name", "releasedate", "developer", "genre", "rating", "players", "desc"]
+# Longest string the menu shows for a field (DESC_SIZE - 1 for the description)
+MAXFIELDLEN = 1023
+HEADER = struct.Struct("<4sHHII")
+INDEXENTRY = struct.Struct("<IIHH")
+
+
+def get_tag_text(xml, tag):
+    """Same extraction as Frens::get_tag_text()."""
+    start = xml.find("<" + tag)
+    if start < 0:
+        return ""
+    start = xml.find(">", start)
+    if start < 0:
+        return ""
+    start += 1
+    end = xml.find("</" + tag + ">", start)
+    if end < 0:
+        return ""
+    return xml[start:end]
+
+
+def build_record(xml):
+    strings = bytearray()
+    offsets = []
+    base = 2 * len(FIELDS)
+    for tag in FIELDS:
+        value = get_tag_text(xml, tag).encode("latin-1", errors="replace")[:MAXFIELDLEN]
+        offsets.append(base + len(strings))
+        strings += value + b"\0"
+    record = struct.pack("<%dH" % len(FIELDS), *offsets) + strings
+    if len(record) > 0xFFFF:
+        raise ValueError("record too large")
+    return record
+
+
+def build_system(sysdir):
+    descrdir = os.path.join(sysdir, "descr")
+    entries = {}
+    for sub in sorted(os.listdir(descrdir)):
+        subdir = os.path.join(descrdir, sub)
+        if not os.path.isdir(subdir):
+            continue
+        for fname in os.listdir(subdir):
+            base, ext = os.path.splitext(fname)
+            if ext.lower() != ".txt" or len(base) != 8:
+                continue
+            try:
+                crc = int(base, 16)
+            except ValueError:
+                continue
+            with open(os.path.join(subdir, fname), "rb") as f:
+                xml = f.read().decode("latin-1")
+            entries[crc] = build_record(xml)
+
+    crcs = sorted(entries)
+    fanout = [0] * 257
+    for crc in crcs:
+        fanout[(crc >> 24) + 1] += 1
+    for b in range(256):
+        fanout[b + 1] += fanout[b]
+
+    indexoffset = HEADER.size + 4 * len(fanout)
+    recordoffset = indexoffset + INDEXENTRY.size * len(crcs)
+    index = bytearray()
+    records = bytearray()
+    for crc in crcs:
+        record = entries[crc]
+        index += INDEXENTRY.pack(crc, recordoffset + len(records), len(record), 0)
+        records += record
+
+    out = os.path.join(sysdir, "metadata.db")
+    with open(out, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, len(FIELDS), len(crcs), indexoffset))
+        f.write(struct.pack("<257I", *fanout))
+        f.write(index)
+        f.write(records)
+    print("%s: %d entries, %d bytes" % (out, len(crcs), recordoffset + len(records)))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+    root = sys.argv[1]
+    systems = sys.argv[2:] or sorted(os.listdir(root))
+    for system in systems:
+        sysdir = os.path.join(root, system)
+        if os.path.isdir(os.path.join(sysdir, "descr")):
+            build_system(sysdir)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())